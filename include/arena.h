@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Size of the blocks an Arena carves allocations out of (larger allocations get a block of their
+// own), and how much of them it keeps for reuse after a reset.
+static constexpr std::size_t ARENA_BLOCK_SIZE = 1 << 14;
+static constexpr std::size_t ARENA_RETAIN_SIZE = 1 << 20;
+
+/**
+ * Bump allocator for objects that mostly die together, like the nodes parsed out of a query.
+ * Allocating only moves a pointer within the current block, and freeing only counts down the
+ * block's live allocations.
+ *
+ * reset() rewinds the blocks that have nothing left alive in them. A block still in use (say, by
+ * a command queued in a transaction) is handed off instead, and frees itself along with its last
+ * allocation. Neither the arena nor what it allocates may be shared between threads.
+ */
+class Arena {
+public:
+    Arena()
+        : current_(0) { }
+    ~Arena() { release_(); }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    Arena(Arena &&);
+    Arena &operator=(Arena &&);
+
+    void *allocate(std::size_t);
+    static void deallocate(void *);
+
+    void reset();
+
+private:
+    struct alignas(std::max_align_t) Block {
+        std::size_t capacity;
+        std::size_t used;
+        std::size_t live;
+        bool retired;
+
+        inline char *data() { return reinterpret_cast<char *>(this + 1); }
+    };
+
+    // Each allocation is preceded by the block it came from
+    struct alignas(std::max_align_t) Header {
+        Block *block;
+    };
+
+    std::vector<Block *> blocks_;
+    std::size_t current_;
+
+    static Block *newBlock_(std::size_t);
+    static void retire_(Block *);
+    void release_();
+};
+
+// Standard allocator over an Arena, for std::allocate_shared and containers.
+template <typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena *arena)
+        : arena_(arena) { }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other)
+        : arena_(other.arena()) { }
+
+    inline T *allocate(std::size_t n) { return static_cast<T *>(arena_->allocate(n * sizeof(T))); }
+    inline void deallocate(T *p, std::size_t) { Arena::deallocate(p); }
+
+    inline Arena *arena() const { return arena_; }
+
+private:
+    Arena *arena_;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.arena() == b.arena();
+}
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.arena() != b.arena();
+}
+
+// Like std::make_shared, allocating the object (with its reference counts) out of an arena when
+// given one.
+template <typename T, typename... Args>
+inline std::shared_ptr<T> makeShared(Arena *arena, Args &&...args) {
+    if (!arena) return std::make_shared<T>(std::forward<Args>(args)...);
+    return std::allocate_shared<T>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "error_msgs.h"
+
+#include <cstring>
+
+// Bounds-checked cursor over an in-memory buffer, such as a mapped save file.
+class ByteReader {
+public:
+    ByteReader(const char *data, std::size_t size)
+        : pos_(data)
+        , end_(data + size) { }
+
+    inline bool atEnd() const { return pos_ == end_; }
+    inline std::size_t remaining() const { return end_ - pos_; }
+    inline const char *position() const { return pos_; }
+
+    // Returns a pointer to the next `n` bytes and moves past them.
+    const char *take(std::size_t n) {
+        if (n > remaining()) throw RuntimeErr(TRUNC_SAVE);
+        const char *start = pos_;
+        pos_ += n;
+        return start;
+    }
+
+    inline void skip(std::size_t n) { take(n); }
+    inline char readChar() { return *take(1); }
+
+    template <typename T>
+    T read() {
+        T t;
+        std::memcpy(&t, take(sizeof(T)), sizeof(T));
+        return t;
+    }
+
+private:
+    const char *pos_;
+    const char *end_;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "arena.h"
 #include "syntax_tree.h"
 
 class QuitCommand : public SystemCommand {
@@ -21,6 +22,7 @@ public:
     SetCommand()
         : StoreCommand(CommandType::SET) { }
     virtual bool validate() const override;
+    virtual bool validateValues() const override;
     virtual void execute(EnvironmentInterface &, Store &) const override;
 };
 
@@ -36,6 +38,7 @@ class ListCommand : public StoreCommand {
 public:
     ListCommand()
         : StoreCommand(CommandType::LIST, true) { }
+    virtual bool validateValues() const override;
     virtual void execute(EnvironmentInterface &, Store &) const override;
 };
 
@@ -77,6 +80,13 @@ public:
     virtual void execute(EnvironmentInterface &, Store &) const override;
 };
 
+class CompactCommand : public StoreCommand {
+public:
+    CompactCommand()
+        : StoreCommand(CommandType::COMPACT, true) { }
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
 class RenameCommand : public StoreCommand {
 public:
     RenameCommand()
@@ -117,6 +127,98 @@ public:
     virtual void execute(EnvironmentInterface &, Store &) const override;
 };
 
+class PopFrontCommand : public StoreCommand {
+public:
+    PopFrontCommand()
+        : StoreCommand(CommandType::POPFRONT) { }
+    virtual bool validate() const override;
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
+class PopBackCommand : public StoreCommand {
+public:
+    PopBackCommand()
+        : StoreCommand(CommandType::POPBACK) { }
+    virtual bool validate() const override;
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
+class IndexCommand : public StoreCommand {
+public:
+    IndexCommand()
+        : StoreCommand(CommandType::INDEX) { }
+    virtual bool validate() const override;
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
+class RangeCommand : public StoreCommand {
+public:
+    RangeCommand()
+        : StoreCommand(CommandType::RANGE) { }
+    virtual bool validate() const override;
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
+class TrimCommand : public StoreCommand {
+public:
+    TrimCommand()
+        : StoreCommand(CommandType::TRIM) { }
+    virtual bool validate() const override;
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
+class ExpireCommand : public StoreCommand {
+public:
+    ExpireCommand()
+        : StoreCommand(CommandType::EXPIRE) { }
+    virtual bool validate() const override;
+    virtual bool validateValues() const override;
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
+class TtlCommand : public StoreCommand {
+public:
+    TtlCommand()
+        : StoreCommand(CommandType::TTL) { }
+    virtual bool validate() const override;
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
+class PersistCommand : public StoreCommand {
+public:
+    PersistCommand()
+        : StoreCommand(CommandType::PERSIST) { }
+    virtual bool validate() const override;
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
+// Only ever read back from the command log, which records deadlines rather than the durations
+// they were given as, so replaying them later doesn't push them back.
+class ExpireAtCommand : public StoreCommand {
+public:
+    ExpireAtCommand()
+        : StoreCommand(CommandType::EXPIREAT) { }
+    virtual bool validate() const override;
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
+class ScanCommand : public StoreCommand {
+public:
+    ScanCommand()
+        : StoreCommand(CommandType::SCAN, true) { }
+    virtual bool validate() const override;
+    virtual bool validateValues() const override;
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
+class RefsCommand : public StoreCommand {
+public:
+    RefsCommand()
+        : StoreCommand(CommandType::REFS, true) { }
+    virtual bool validate() const override;
+    virtual void execute(EnvironmentInterface &, Store &) const override;
+};
+
 class SearchCommand : public StoreCommand {
 public:
     SearchCommand()
@@ -152,3 +254,7 @@ public:
         : SystemCommand(CommandType::ROLLBACK) { }
     void execute(EnvironmentInterface &) const override;
 };
+
+// Creates an empty command node of the given type (out of the arena, if given one), or nullptr for
+// unknown types.
+CommandSP makeCommand(CommandType, Arena * = nullptr);
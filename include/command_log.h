@@ -0,0 +1,117 @@
+#pragma once
+
+#include "syntax_tree.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+class EnvironmentInterface;
+class Store;
+
+/**
+ * Append-only log of the commands that changed the Store:
+ *
+ *   [magic][version][snapshot size][snapshot][record 0][record 1]...
+ *
+ *   snapshot: the Store as it was when the log was last rewritten, in the versioned save format
+ *             (v1 logs have neither the snapshot nor its size, a new log has a size of zero)
+ *   record:   [payload size][CRC32C of payload][payload]
+ *   payload:  [command type][options][number of args][arg 1|arg 2|...|arg n|], where each argument
+ *             is encoded like a saved value (a missing argument is nil)
+ *
+ * Commands are buffered as they execute and written out together on commit(), so every command of
+ * a batch of queries shares a single write and, under FsyncPolicy::ALWAYS, a single fdatasync.
+ *
+ * Rewriting folds the log into a fresh snapshot of the Store. A forked child writes the snapshot
+ * into a new log while commands carry on being committed to the old one, and are kept aside as
+ * well. Once the child is done, those commands are appended to the new log, which is then renamed
+ * over the old one.
+ */
+static const std::string COMMAND_LOG_MAGIC = "KEPLERKV-LOG|";
+static constexpr uint32_t COMMAND_LOG_VERSION = 2;
+
+// Default fsync interval under FsyncPolicy::INTERVAL.
+static constexpr unsigned int COMMAND_LOG_FSYNC_MS = 1000;
+
+// The log is rewritten once it has grown by this percentage since the last rewrite (or since it
+// was opened), as long as it is at least COMMAND_LOG_REWRITE_MIN_SIZE bytes.
+static constexpr unsigned int COMMAND_LOG_REWRITE_PCT = 100;
+static constexpr std::size_t COMMAND_LOG_REWRITE_MIN_SIZE = 4 << 20;
+
+enum class FsyncPolicy {
+    ALWAYS,   // fdatasync on every commit, before it returns
+    INTERVAL, // fdatasync from a background thread every N milliseconds, when there were writes
+    OS,       // never fdatasync, leave flushing to the OS
+};
+
+// Outcome of replaying a log file.
+struct CommandLogReplay {
+    std::size_t commands = 0;
+    // Bytes dropped from the end of the file, left by a write that was cut short
+    std::size_t discardedBytes = 0;
+};
+
+class CommandLog {
+public:
+    CommandLog();
+    ~CommandLog();
+
+    CommandLog(const CommandLog &) = delete;
+    CommandLog &operator=(const CommandLog &) = delete;
+
+    // Opens (or creates) a log file to append to.
+    void open(const std::string &, FsyncPolicy = FsyncPolicy::INTERVAL,
+        unsigned int intervalMs = COMMAND_LOG_FSYNC_MS);
+    void close();
+    inline bool isOpen() const { return fd_ >= 0; }
+
+    // Buffers a command, including only its first `numArgs` arguments.
+    void append(const Command &, std::size_t numArgs);
+
+    // Writes out all buffered commands, syncing them according to the policy.
+    void commit();
+
+    // Starts rewriting the log in the background. Only one rewrite runs at a time.
+    void rewrite(Store &);
+
+    // Completes a finished rewrite, then starts another if the log has outgrown the growth
+    // percentage (zero disables automatic rewrites).
+    void checkRewrite(Store &);
+    inline void setRewritePercentage(unsigned int pct) { rewritePct_ = pct; }
+
+    inline bool isRewriting() const { return rewritePid_ > 0; }
+    inline std::size_t fileSize() const { return size_; }
+
+    // Executes every command in a log file against the Store, then truncates any damaged tail.
+    // A missing file is treated as an empty log.
+    static CommandLogReplay replay(const std::string &, EnvironmentInterface &, Store &);
+
+private:
+    int fd_;
+    std::string filename_;
+    FsyncPolicy policy_;
+    std::vector<uint8_t> buf_;
+    std::size_t size_;
+
+    // Rewriting
+    pid_t rewritePid_;
+    std::vector<uint8_t> rewriteBuf_;
+    std::size_t baseSize_;
+    unsigned int rewritePct_;
+
+    // Background syncing for FsyncPolicy::INTERVAL
+    std::thread syncThread_;
+    std::mutex syncMtx_;
+    std::condition_variable syncCv_;
+    bool dirty_;
+    bool syncing_;
+    bool stopping_;
+
+    void syncLoop_(unsigned int intervalMs);
+    void finishRewrite_(bool wait);
+};
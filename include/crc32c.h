@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli) checksum of a buffer. Pass a previous result as `crc` to continue it.
+uint32_t crc32c(const void *data, std::size_t size, uint32_t crc = 0);
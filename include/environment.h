@@ -1,6 +1,9 @@
 #pragma once
 
+#include "command_log.h"
 #include "environment_interface.h"
+#include "error_msgs.h"
+#include "plan_cache.h"
 #include "syntax_tree.h"
 
 #include <deque>
@@ -8,22 +11,63 @@
 
 using WALType = std::deque<StoreCommandSP>;
 
+// Scripts write out their output (and log their changes) once this much output has built up.
+static constexpr std::size_t OUTPUT_BATCH_SIZE = 1 << 16;
+
 class Environment : public EnvironmentInterface {
 public:
     // Dummy env with a nullptr Store
     Environment()
-        : silentMode_(false) { }
+        : log_(nullptr)
+        , plans_(nullptr)
+        , silentMode_(false) { }
     Environment(Store *s_ptr)
         : store_(s_ptr)
+        , log_(nullptr)
+        , plans_(nullptr)
         , silentMode_(false) { }
 
+    // Output is buffered until flush(), so a whole batch of queries is written out at once
     void printToConsole(const std::string &s = "", bool ignoreSilent = false) override {
-        if (ignoreSilent || !silentMode_) std::cout << s << std::endl;
+        if (ignoreSilent || !silentMode_) {
+            output_ += s;
+            output_ += '\n';
+        }
     }
     void setSilentMode(bool s) { silentMode_ = s; }
 
+    std::string &output() { return output_; }
+    void flush() {
+        if (output_.empty()) return;
+        std::cout.write(output_.data(), output_.size());
+        std::cout.flush();
+        output_.clear();
+    }
+
+    // Ends a batch of queries: logs their changes, then writes out their output
+    void endBatch() {
+        commitLog();
+        flush();
+    }
+
+    // An empty answer counts as a yes
+    bool confirm() override {
+        flush();
+        std::string answer;
+        std::getline(std::cin, answer);
+        return answer.empty() || answer[0] == 'y';
+    }
+
+    void exitSuccess() override {
+        endBatch();
+        EnvironmentInterface::exitSuccess();
+    }
+
     Store *getStore() override { return store_; }
 
+    void setPlanCache(PlanCache *plans) { plans_ = plans; }
+    PlanCache *getPlanCache() override { return plans_; }
+
     // Transaction handling
     std::size_t sizeWAL() override { return wal_.size(); }
     bool isWALEmpty() override { return wal_.empty(); }
@@ -44,8 +88,31 @@ public:
         }
     }
 
+    // Durability
+    void setCommandLog(CommandLog *log) { log_ = log; }
+
+    void logCommand(const Command &cmd, std::size_t numArgs) override {
+        if (log_) log_->append(cmd, numArgs);
+    }
+    bool isLogging() const override { return log_ != nullptr; }
+    void compactLog(Store &s) override {
+        if (!log_) throw RuntimeErr(NO_COMMAND_LOG);
+        log_->rewrite(s);
+    }
+
+    // Writes out the commands logged by a batch of queries, then compacts the log if it has grown
+    // enough
+    void commitLog() {
+        if (!log_) return;
+        log_->commit();
+        log_->checkRewrite(*store_);
+    }
+
 private:
     Store *store_;
+    CommandLog *log_;
+    PlanCache *plans_;
     WALType wal_;
+    std::string output_;
     bool silentMode_;
 };
@@ -8,6 +8,8 @@
 #include <string>
 
 // Forward declarations
+class Command;
+class PlanCache;
 class Store;
 class StoreCommand;
 using StoreCommandSP = std::shared_ptr<StoreCommand>;
@@ -27,6 +29,9 @@ public:
 
     virtual Store *getStore() = 0;
 
+    // Plans shared by the queries run in this environment, if any
+    virtual PlanCache *getPlanCache() { return nullptr; }
+
     // Transaction handling
     void setTransacState(bool t) { transac_ = t; };
     bool inTransaction() { return transac_; };
@@ -39,7 +44,16 @@ public:
     virtual StoreCommandSP getNextCommand() = 0;
     virtual void executeAllWAL() = 0;
 
-    void exitSuccess() { exit(EXIT_SUCCESS); }
+    // Durability: records a command that changed the store, keeping only its first `numArgs`
+    // arguments (those that took effect). Does nothing unless a command log is in use.
+    virtual void logCommand(const Command &, std::size_t numArgs) = 0;
+    virtual bool isLogging() const { return false; }
+    virtual void compactLog(Store &) = 0;
+
+    // Asks the user a yes or no question printed just before.
+    virtual bool confirm() = 0;
+
+    virtual void exitSuccess() { exit(EXIT_SUCCESS); }
 
 protected:
     bool running_;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdexcept>
+#include <string>
 
 using Exception = std::exception;
 using RuntimeErr = std::runtime_error;
@@ -12,14 +13,31 @@ using RuntimeErr = std::runtime_error;
 #define NOT_IDENT       "Error: expected identifier"
 #define NOT_NUMERIC     "Error: not numeric (integer or float)"
 #define NOT_LIST        "Error: not a list"
+#define EMPTY_LIST      "Error: list is empty"
+#define IDX_OUT_RANGE   "Error: index out of range"
+#define INVALID_TTL     "Error: invalid duration (a positive integer, then ms, s, m, h or d)"
 #define VAL_AFTER_IDENT "Error: expected value after identifier"
 #define CIRCULAR_REF    "Error: circular reference detected"
+#define OUT_OF_MEMORY   "Error: store is over its memory limit, and nothing can be evicted"
 #define NESTED_CMD      "Error: nested commands not supported (yet?)"
 #define CMD_IN_LIST     "Error: commands not supported within lists"
 #define FAIL_OPEN_WRITE "Error: failed to open file to write"
 #define FAIL_OPEN_READ  "Error: failed to open file to read (check if it exists!)"
 #define NOT_VALID_SAVE  "Error: not a valid KEPLER-SAVE file"
 #define UNK_SAVE_ITEM   "Error: unknown item type found in save file"
+#define TRUNC_SAVE      "Error: save file is truncated"
+#define CORRUPT_SAVE    "Error: save file is corrupted (checksum mismatch)"
+#define UNSUP_SAVE_VER  "Error: save file was written by a newer, unsupported version"
+#define BG_SAVE_RUNNING "Error: a background save is already in progress"
+#define FAIL_BG_SAVE    "Error: failed to start a background save"
+#define FAIL_LOG_WRITE  "Error: failed to write to the command log"
+#define NOT_VALID_LOG   "Error: not a valid KEPLER-LOG file"
+#define UNSUP_LOG_VER   "Error: command log was written by a newer, unsupported version"
+#define NO_COMMAND_LOG  "Error: no command log in use (start with --log)"
+#define COMPACT_RUNNING "Error: the command log is already being compacted"
+#define FAIL_COMPACT    "Error: failed to start compacting the command log"
+#define FAIL_LISTEN     "Error: failed to listen on socket"
+#define FAIL_SERVER     "Error: server event loop failed"
 #define INVALID_FNAME   "Error: invalid filename, must be valid string or identifier"
 
 inline RuntimeErr MIN_ONE_ARG_K(const std::string &c) {
@@ -38,6 +56,10 @@ inline RuntimeErr INVALID_CMD(const std::string &c) {
     return RuntimeErr("Error: invalid command \'" + c + "\' (did you forget a quote or slash?)");
 }
 
+inline RuntimeErr FAILED_REPLAY(std::size_t n, const std::string &err) {
+    return RuntimeErr(err + ", while replaying command " + std::to_string(n) + " of the log");
+}
+
 inline RuntimeErr UNKNOWN_TOKEN(const std::string &t) {
     return RuntimeErr("Error: unknown token [ " + t + " ]");
 }
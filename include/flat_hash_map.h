@@ -0,0 +1,300 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Open-addressing hash map from std::string keys, laid out like a Swiss table: one flat array of
+ * slots and a parallel array of one-byte control words. A full slot's control byte holds 7 bits of
+ * its key's hash, so a probe checks a whole group of 16 slots at once (with SSE2 when available)
+ * and only compares strings on a likely match.
+ *
+ * Every slot remembers its key's full hash, so growing the table never rehashes strings. Callers
+ * hash the key themselves, which lets the Store reuse one hash for shard selection and lookup.
+ */
+template <typename V>
+class FlatHashMap {
+public:
+    struct Slot {
+        std::size_t hash;
+        std::string key;
+        V value;
+        // Left to the owner, zero for a new key (the Store keeps a key's access stats in it)
+        uint32_t meta;
+    };
+
+    static constexpr std::size_t GROUP_WIDTH = 16;
+
+    FlatHashMap()
+        : ctrl_(nullptr)
+        , slots_(nullptr)
+        , capacity_(0)
+        , size_(0)
+        , growthLeft_(0) { }
+    explicit FlatHashMap(std::size_t n)
+        : FlatHashMap() {
+        reserve(n);
+    }
+    ~FlatHashMap() { destroy_(); }
+
+    FlatHashMap(const FlatHashMap &) = delete;
+    FlatHashMap &operator=(const FlatHashMap &) = delete;
+
+    inline std::size_t size() const { return size_; }
+    inline std::size_t capacity() const { return capacity_; }
+    inline bool empty() const { return size_ == 0; }
+
+    // Returns a pointer to the key's value, or nullptr if it is not present.
+    V *find(const std::string &key, std::size_t hash) const {
+        Slot *slot = findSlot_(key, hash);
+        return slot ? &slot->value : nullptr;
+    }
+
+    // Returns the key's slot, or nullptr if it is not present.
+    Slot *findSlot(const std::string &key, std::size_t hash) const { return findSlot_(key, hash); }
+
+    // Starts loading the first group the hash probes, so the cache misses of several lookups in a
+    // row overlap rather than each stalling in turn.
+    void prefetch(std::size_t hash) const {
+        if (!capacity_) return;
+        std::size_t g = h1_(hash) & groupMask_();
+        __builtin_prefetch(ctrl_ + g * GROUP_WIDTH);
+        __builtin_prefetch(slots_ + g * GROUP_WIDTH);
+    }
+
+    // Inserts the key, or assigns over its value if present. Returns whether a new key was added.
+    template <typename K, typename U>
+    bool insertOrAssign(K &&key, std::size_t hash, U &&value) {
+        Slot *slot = findSlot_(key, hash);
+        if (slot) {
+            slot->value = std::forward<U>(value);
+            return false;
+        }
+
+        std::size_t pos = prepareInsert_(hash);
+        new (&slots_[pos]) Slot { hash, std::forward<K>(key), std::forward<U>(value), 0 };
+        return true;
+    }
+
+    // Returns the key's slot, inserting it with a default value first if it is not present.
+    template <typename K>
+    Slot *findOrInsert(K &&key, std::size_t hash, bool &inserted) {
+        Slot *slot = findSlot_(key, hash);
+        inserted = !slot;
+        if (slot) return slot;
+
+        std::size_t pos = prepareInsert_(hash);
+        return new (&slots_[pos]) Slot { hash, std::forward<K>(key), V(), 0 };
+    }
+
+    // Removes the key, moving its value into `out`. Returns false if the key is not present.
+    bool take(const std::string &key, std::size_t hash, V &out) {
+        Slot *slot = findSlot_(key, hash);
+        if (!slot) return false;
+        out = std::move(slot->value);
+        eraseSlot_(slot - slots_);
+        return true;
+    }
+
+    // Removes the key, no effect if it is not present. Returns whether a deletion occurred.
+    bool erase(const std::string &key, std::size_t hash) {
+        Slot *slot = findSlot_(key, hash);
+        if (!slot) return false;
+        eraseSlot_(slot - slots_);
+        return true;
+    }
+
+    // Removes an item by its slot, as found by findSlot() or findOrInsert().
+    void erase(Slot *slot) { eraseSlot_(slot - slots_); }
+
+    // Grows the table (if needed) so that `n` keys fit without another resize.
+    void reserve(std::size_t n) {
+        std::size_t cap = GROUP_WIDTH;
+        while (maxLoad_(cap) < n)
+            cap <<= 1;
+        if (cap > capacity_) resize_(cap);
+    }
+
+    void clear() {
+        destroy_();
+        ctrl_ = nullptr;
+        slots_ = nullptr;
+        capacity_ = size_ = growthLeft_ = 0;
+    }
+
+    // Calls f(key, value) on every item, in slot order.
+    template <typename F>
+    void forEach(F &&f) const {
+        for (std::size_t i = 0; i < capacity_; i++)
+            if (isFull_(ctrl_[i])) f(slots_[i].key, slots_[i].value);
+    }
+
+    // Calls f(slot) on up to `count` items, the first ones found walking the table from position
+    // `start` (wrapping around). Hashing spreads keys evenly over the table, so a random start
+    // makes a cheap random sample.
+    template <typename F>
+    void sample(std::size_t start, std::size_t count, F &&f) const {
+        if (!size_) return;
+        for (std::size_t i = 0; i < capacity_ && count; i++) {
+            std::size_t pos = (start + i) & (capacity_ - 1);
+            if (!isFull_(ctrl_[pos])) continue;
+            f(slots_[pos]);
+            count--;
+        }
+    }
+
+private:
+    static constexpr int8_t CTRL_EMPTY = -128;
+    static constexpr int8_t CTRL_DELETED = -2;
+
+    // Matches the control bytes of one group against a byte, returning a bitmask of hits.
+    class Group {
+    public:
+        explicit Group(const int8_t *ctrl)
+            : ctrl_(ctrl) { }
+
+#ifdef __SSE2__
+        uint32_t match(int8_t h2) const {
+            __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl_));
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+        }
+        // Empty and deleted bytes are the only ones with the sign bit set
+        uint32_t matchEmptyOrDeleted() const {
+            __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl_));
+            return _mm_movemask_epi8(ctrl);
+        }
+#else
+        uint32_t match(int8_t h2) const {
+            uint32_t mask = 0;
+            for (std::size_t i = 0; i < GROUP_WIDTH; i++)
+                if (ctrl_[i] == h2) mask |= 1u << i;
+            return mask;
+        }
+        uint32_t matchEmptyOrDeleted() const {
+            uint32_t mask = 0;
+            for (std::size_t i = 0; i < GROUP_WIDTH; i++)
+                if (ctrl_[i] < 0) mask |= 1u << i;
+            return mask;
+        }
+#endif
+        uint32_t matchEmpty() const { return match(CTRL_EMPTY); }
+
+    private:
+        const int8_t *ctrl_;
+    };
+
+    int8_t *ctrl_;
+    Slot *slots_;
+    std::size_t capacity_;
+    std::size_t size_;
+    std::size_t growthLeft_;
+
+    // The low 7 bits go in the control byte, the rest pick the starting group
+    static inline int8_t h2_(std::size_t hash) { return (int8_t) (hash & 0x7F); }
+    static inline std::size_t h1_(std::size_t hash) { return hash >> 7; }
+    static inline bool isFull_(int8_t c) { return c >= 0; }
+    static inline std::size_t maxLoad_(std::size_t cap) { return cap - cap / 8; }
+
+    inline std::size_t groupMask_() const { return capacity_ / GROUP_WIDTH - 1; }
+
+    Slot *findSlot_(const std::string &key, std::size_t hash) const {
+        if (!capacity_) return nullptr;
+
+        std::size_t mask = groupMask_();
+        std::size_t g = h1_(hash) & mask;
+        int8_t h2 = h2_(hash);
+
+        // Triangular probing over groups visits every group when the count is a power of two
+        for (std::size_t i = 1;; i++) {
+            Group group(ctrl_ + g * GROUP_WIDTH);
+            for (uint32_t m = group.match(h2); m; m &= m - 1) {
+                Slot &slot = slots_[g * GROUP_WIDTH + __builtin_ctz(m)];
+                if (slot.hash == hash && slot.key == key) return &slot;
+            }
+            if (group.matchEmpty()) return nullptr;
+            g = (g + i) & mask;
+        }
+    }
+
+    // Finds the first empty or deleted slot along the hash's probe sequence.
+    std::size_t findInsertPos_(std::size_t hash) const {
+        std::size_t mask = groupMask_();
+        std::size_t g = h1_(hash) & mask;
+        for (std::size_t i = 1;; i++) {
+            uint32_t m = Group(ctrl_ + g * GROUP_WIDTH).matchEmptyOrDeleted();
+            if (m) return g * GROUP_WIDTH + __builtin_ctz(m);
+            g = (g + i) & mask;
+        }
+    }
+
+    // Claims a slot for a new key with this hash, growing first if needed. Leaves it unconstructed.
+    std::size_t prepareInsert_(std::size_t hash) {
+        if (!capacity_) resize_(GROUP_WIDTH);
+
+        std::size_t pos = findInsertPos_(hash);
+        if (ctrl_[pos] == CTRL_EMPTY && growthLeft_ == 0) {
+            // Enough tombstones to reclaim: rebuild in place, otherwise double
+            resize_(size_ * 32 <= capacity_ * 25 ? capacity_ : capacity_ * 2);
+            pos = findInsertPos_(hash);
+        }
+
+        if (ctrl_[pos] == CTRL_EMPTY) growthLeft_--;
+        ctrl_[pos] = h2_(hash);
+        size_++;
+        return pos;
+    }
+
+    void eraseSlot_(std::size_t pos) {
+        slots_[pos].~Slot();
+        size_--;
+
+        // A group with an empty slot never overflowed, so no probe sequence continues past it
+        // and the slot can become empty again instead of a tombstone.
+        std::size_t groupStart = pos - pos % GROUP_WIDTH;
+        if (Group(ctrl_ + groupStart).matchEmpty()) {
+            ctrl_[pos] = CTRL_EMPTY;
+            growthLeft_++;
+        } else {
+            ctrl_[pos] = CTRL_DELETED;
+        }
+    }
+
+    void resize_(std::size_t newCapacity) {
+        int8_t *oldCtrl = ctrl_;
+        Slot *oldSlots = slots_;
+        std::size_t oldCapacity = capacity_;
+
+        ctrl_ = new int8_t[newCapacity];
+        std::memset(ctrl_, CTRL_EMPTY, newCapacity);
+        slots_ = static_cast<Slot *>(::operator new(newCapacity * sizeof(Slot)));
+        capacity_ = newCapacity;
+        growthLeft_ = maxLoad_(newCapacity) - size_;
+
+        // Stored hashes place every item without touching its key
+        for (std::size_t i = 0; i < oldCapacity; i++) {
+            if (!isFull_(oldCtrl[i])) continue;
+
+            std::size_t pos = findInsertPos_(oldSlots[i].hash);
+            ctrl_[pos] = oldCtrl[i];
+            new (&slots_[pos]) Slot(std::move(oldSlots[i]));
+            oldSlots[i].~Slot();
+        }
+
+        delete[] oldCtrl;
+        ::operator delete(oldSlots);
+    }
+
+    void destroy_() {
+        for (std::size_t i = 0; i < capacity_; i++)
+            if (isFull_(ctrl_[i])) slots_[i].~Slot();
+        delete[] ctrl_;
+        ::operator delete(slots_);
+    }
+};
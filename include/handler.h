@@ -24,4 +24,12 @@ private:
     Parser parser_;
     Store *store_;
     Environment *env_;
+
+    // Reused for the shape key of every query
+    std::string planKey_;
+
+    void execute_(const CommandSP &);
+
+    // Evicts keys until the store is back under its memory cap, throwing if it can't be.
+    void makeRoom_();
 };
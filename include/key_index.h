@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Most keys a leaf holds, and most children an inner node has, before splitting in two.
+static constexpr std::size_t KEY_INDEX_NODE_CAPACITY = 64;
+
+/**
+ * Ordered index of keys, as a B+ tree: sorted runs of keys in leaves linked in order, under inner
+ * nodes holding the first key of each of their children but the first. A key is found with a
+ * binary search per level over few levels of compact nodes, and ordered scans walk from leaf to
+ * leaf.
+ *
+ * Leaves are not merged as they shrink, only dropped once empty, so a tree that lost most of its
+ * keys stays sparse until keys come back to the same ranges.
+ */
+class KeyIndex {
+public:
+    KeyIndex();
+    ~KeyIndex();
+
+    KeyIndex(const KeyIndex &) = delete;
+    KeyIndex &operator=(const KeyIndex &) = delete;
+
+    inline std::size_t size() const { return size_; }
+
+    // Both return whether the index changed.
+    bool insert(const std::string &);
+    bool erase(const std::string &);
+
+    // Calls f(key) on the keys not less than `from`, in order, until it returns false.
+    template <typename F>
+    void scan(const std::string &from, F &&f) const;
+
+private:
+    struct Node {
+        explicit Node(bool leaf)
+            : isLeaf(leaf) { }
+        const bool isLeaf;
+    };
+
+    struct Leaf : Node {
+        Leaf()
+            : Node(true)
+            , prev(nullptr)
+            , next(nullptr) { }
+        std::vector<std::string> keys;
+        Leaf *prev;
+        Leaf *next;
+    };
+
+    // children[i + 1] holds the keys from separators[i] on
+    struct Inner : Node {
+        Inner()
+            : Node(false) { }
+        std::vector<std::string> separators;
+        std::vector<Node *> children;
+    };
+
+    Node *root_;
+    std::size_t size_;
+
+    static std::size_t childFor_(const Inner &, const std::string &);
+    const Leaf *leafFor_(const std::string &) const;
+    bool insert_(Node *, const std::string &, Node *&split, std::string &separator);
+    bool erase_(Node *, const std::string &, bool &emptied);
+    static void destroy_(Node *);
+};
+
+template <typename F>
+void KeyIndex::scan(const std::string &from, F &&f) const {
+    const Leaf *leaf = leafFor_(from);
+    std::size_t i
+        = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), from) - leaf->keys.begin();
+    for (; leaf; leaf = leaf->next, i = 0) {
+        for (; i < leaf->keys.size(); i++)
+            if (!f(leaf->keys[i])) return;
+    }
+}
@@ -7,24 +7,28 @@
 
 class Lexer {
 public:
-    std::vector<TokenSP> tokens;
+    // Reused from query to query, so it stops allocating once it has grown to fit
+    std::vector<Token> tokens;
 
     Lexer()
-        : tokens(std::vector<TokenSP>()) {};
+        : tokens(std::vector<Token>()) {};
 
-    std::vector<TokenSP> &tokenize(std::string &);
+    std::vector<Token> &tokenize(const std::string &);
 
 private:
     char curr_();
     char peek_();
     char peekNext_();
 
-    std::string::iterator it_;
-    std::string::iterator iend_;
+    const char *begin_;
+    const char *it_;
+    const char *iend_;
 
-    TokenSP lexCommand_();
-    TokenSP lexIdentifier_();
-    TokenSP lexNumber_();
-    TokenSP lexString_();
-    TokenSP lexOption_();
+    Token token_(TokenType, const char *start) const;
+
+    Token lexCommand_();
+    Token lexIdentifier_();
+    Token lexNumber_();
+    Token lexString_();
+    Token lexOption_();
 };
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file, unmapped when it goes out of scope.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    inline const char *data() const { return data_; }
+    inline std::size_t size() const { return size_; }
+
+private:
+    const char *data_;
+    std::size_t size_;
+};
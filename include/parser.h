@@ -1,5 +1,7 @@
 #pragma once
 
+#include "arena.h"
+#include "plan_cache.h"
 #include "syntax_tree.h"
 #include "token.h"
 
@@ -7,20 +9,42 @@ class Parser {
 public:
     std::vector<CommandSP> nodes;
 
+    // Leaf nodes of the literals parsed for a plan, in query order
+    std::vector<ValueSP> slots;
+
     Parser()
-        : nodes(std::vector<CommandSP>()) {};
+        : nodes(std::vector<CommandSP>())
+        , alloc_(nullptr)
+        , recordSlots_(false) {};
+
+    // Tokens are read straight out of the query they were lexed from. The nodes of the previous
+    // query are released, and their memory reused.
+    std::vector<CommandSP> &parse(const std::string &, std::vector<Token> &, bool forPlan = false);
 
-    std::vector<CommandSP> &parse(std::vector<TokenSP> &);
+    // Rebinds a cached plan to the literals of a query of the same shape.
+    void bind(const std::string &, const std::vector<Token> &, Plan &);
 
 private:
-    TokenSP curr_();
-    TokenSP peek_();
-    TokenSP peekNext_();
+    const Token *curr_();
+    const Token *peek_();
+    const Token *peekNext_();
+
+    const std::string *query_;
+    std::vector<Token>::const_iterator tt_;
+    std::vector<Token>::const_iterator tend_;
+
+    // Reused to hold the text of a token when it has to be a string of its own
+    std::string scratch_;
+    const std::string &text_(const Token &);
+    const std::string &upper_(const Token &);
 
-    std::vector<TokenSP>::iterator tt_;
-    std::vector<TokenSP>::iterator tend_;
+    // Nodes are allocated per query
+    Arena arena_;
+    Arena *alloc_;
+    bool recordSlots_;
 
     CommandSP parseCommand_();
     ValueSP parseValue_();
     ValueSP parseList_();
+    void parseTtl_(Command &);
 };
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Most DFA states a pattern compiles to, and most times a counted repetition ({n,m}) is spelled
+// out. Patterns past either are matched with std::regex instead.
+static constexpr std::size_t PATTERN_MAX_STATES = 2048;
+static constexpr int PATTERN_MAX_REPEAT = 256;
+
+// Number of compiled patterns kept, and of keys matched at a time.
+static constexpr std::size_t PATTERN_CACHE_SIZE = 128;
+static constexpr std::size_t KEY_BATCH_SIZE = 256;
+
+enum class PatternSyntax : uint8_t { REGEX, GLOB };
+
+/**
+ * Keys copied end to end into one buffer, so a pattern can look through all of them at once.
+ */
+class KeyBatch {
+public:
+    KeyBatch()
+        : starts_(1, 0) { }
+
+    inline void add(const std::string &key) {
+        bytes_.append(key);
+        starts_.push_back(bytes_.size());
+    }
+    inline void clear() {
+        bytes_.clear();
+        starts_.resize(1);
+    }
+
+    inline std::size_t size() const { return starts_.size() - 1; }
+    inline bool full() const { return size() >= KEY_BATCH_SIZE; }
+
+    // Key i spans [start(i), start(i + 1)) of the buffer
+    inline const std::string &bytes() const { return bytes_; }
+    inline std::size_t start(std::size_t i) const { return starts_[i]; }
+    inline std::string key(std::size_t i) const {
+        return bytes_.substr(starts_[i], starts_[i + 1] - starts_[i]);
+    }
+
+private:
+    std::string bytes_;
+    std::vector<std::size_t> starts_;
+};
+
+/**
+ * A SEARCH pattern, which must match whole keys: a regex (with std::regex's ECMAScript rules) or a
+ * glob (`*`, `?`, `[...]`). Patterns are compiled to a DFA over classes of bytes the pattern
+ * doesn't tell apart, so matching costs a table lookup per byte of key. Regexes using what the
+ * compiler doesn't support (back references, lookaheads, word boundaries, ...), or that would
+ * need too many states, are left to std::regex.
+ *
+ * Keys are first checked for the longest run of literal text every match must contain, with
+ * memchr or memmem over a whole batch of keys, so only those containing it go through the DFA.
+ */
+class Pattern {
+public:
+    // Throws std::regex_error if a regex is invalid.
+    Pattern(const std::string &source, PatternSyntax);
+
+    // Literal text every matching key begins with, and whether the pattern matches only that.
+    inline const std::string &prefix() const { return prefix_; }
+    inline bool isLiteral() const { return isLiteral_; }
+
+    bool matches(const char *key, std::size_t len) const;
+    inline bool matches(const std::string &key) const { return matches(key.data(), key.size()); }
+
+    // Appends the indexes of the keys in the batch that match, in order.
+    void matchBatch(const KeyBatch &, std::vector<std::size_t> &matched) const;
+
+private:
+    std::unique_ptr<std::regex> regex_; // Only for patterns not compiled
+    std::string prefix_;
+    std::string required_;
+    bool isLiteral_;
+
+    uint8_t byteClass_[256];
+    std::size_t numClasses_;
+    std::vector<uint32_t> next_; // State by state and class; state 0 is dead
+    std::vector<bool> accepting_;
+    uint32_t start_;
+
+    bool run_(const char *, std::size_t) const;
+    void compile_(const std::string &source, PatternSyntax);
+};
+
+/**
+ * Least recently used cache of compiled patterns, safe to share between threads.
+ */
+class PatternCache {
+public:
+    explicit PatternCache(std::size_t capacity = PATTERN_CACHE_SIZE)
+        : capacity_(capacity) { }
+
+    // Returns the compiled pattern, compiling it on a miss. Throws like Pattern's constructor.
+    std::shared_ptr<const Pattern> get(const std::string &source, PatternSyntax);
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const Pattern>>;
+
+    std::size_t capacity_;
+    std::mutex mtx_;
+    std::list<Entry> lru_; // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> patterns_;
+};
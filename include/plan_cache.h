@@ -0,0 +1,71 @@
+#pragma once
+
+#include "syntax_tree.h"
+#include "token.h"
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Number of query shapes whose plans are kept.
+static constexpr std::size_t PLAN_CACHE_SIZE = 1024;
+
+// Queries with more literals than this aren't cached (they gain the least from it, and are the
+// least likely to repeat).
+static constexpr std::size_t PLAN_CACHE_MAX_SLOTS = 64;
+
+struct PlanCacheStats {
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t evictions = 0;
+};
+
+/**
+ * A query parsed and validated once, to be run again for every query of the same shape: the same
+ * tokens, with only the values of its literals (numbers, strings and identifiers) changed.
+ * `slots` holds the leaf nodes of those literals in query order, for the parser to rebind.
+ */
+struct Plan {
+    std::vector<CommandSP> commands;
+    std::vector<ValueSP> slots;
+
+    // A plan can't be rebound while a command of it is still held elsewhere, say by a transaction
+    bool inUse() const;
+};
+
+/**
+ * Least recently used cache of plans, keyed by query shape. A shape key spells out every token
+ * but the literals, which are replaced by their type.
+ */
+class PlanCache {
+public:
+    explicit PlanCache(std::size_t capacity = PLAN_CACHE_SIZE)
+        : capacity_(capacity) { }
+
+    // Builds the shape key of a query, counting its literals. Returns false if the query can't be
+    // cached.
+    static bool shapeKey(const std::string &query, const std::vector<Token> &, std::string &key,
+        std::size_t &numSlots);
+
+    // Returns the plan for a shape, or nullptr (a miss) if there is none or it is in use.
+    Plan *find(const std::string &key);
+
+    // Adds (or replaces) the plan for a shape, evicting the least recently used one if full.
+    Plan *insert(const std::string &key, Plan &&);
+
+    void setCapacity(std::size_t);
+    inline bool isEnabled() const { return capacity_ > 0; }
+    inline std::size_t size() const { return plans_.size(); }
+    inline const PlanCacheStats &stats() const { return stats_; }
+
+private:
+    using Entry = std::pair<std::string, Plan>;
+
+    std::size_t capacity_;
+    std::list<Entry> lru_; // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> plans_;
+    PlanCacheStats stats_;
+
+    void evict_();
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+/**
+ * Collects input as it arrives (from a socket or a file) and splits it into queries, which end at
+ * semicolons outside of quotes. Scanning resumes where it left off, so a long query arriving in
+ * many pieces is only scanned once.
+ */
+class QueryBuffer {
+public:
+    QueryBuffer()
+        : start_(0)
+        , scanPos_(0)
+        , quote_('\0') { }
+
+    inline void append(const char *data, std::size_t n) { buf_.append(data, n); }
+
+    // Moves the next complete, non-blank query (without its semicolon) into `query`.
+    // Returns false once only an incomplete query, if any, is left.
+    bool next(std::string &query);
+
+    void clear();
+
+    // Bytes received but not yet returned as part of a query.
+    inline std::size_t size() const { return buf_.size() - start_; }
+
+private:
+    std::string buf_;
+    std::size_t start_;
+    std::size_t scanPos_;
+    char quote_;
+};
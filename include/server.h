@@ -0,0 +1,111 @@
+#pragma once
+
+#include "environment.h"
+#include "handler.h"
+#include "query_buffer.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Bytes read from a connection per recv() call.
+static constexpr std::size_t SERVER_READ_SIZE = 1 << 16;
+
+// Most bytes read from a connection per wakeup, so that a client sending without pause doesn't
+// hold up the others.
+static constexpr std::size_t SERVER_READ_LIMIT = 1 << 20;
+
+// Longest unfinished query a connection may hold, past which it is dropped.
+static constexpr std::size_t SERVER_MAX_QUERY_SIZE = 64 << 20;
+
+// Most output waiting to be sent to a connection before its queries stop being run (and its input
+// read) until the client has taken some of it.
+static constexpr std::size_t SERVER_OUTPUT_LIMIT = 4 << 20;
+
+// Maximum number of events handled per wakeup of the event loop.
+static constexpr int SERVER_MAX_EVENTS = 64;
+
+// Longest the event loop sleeps without any events, so that expired keys are still reclaimed.
+static constexpr int SERVER_IDLE_TIMEOUT_MS = (int) STORE_EXPIRE_CYCLE_MS;
+
+/**
+ * An environment for a client connection. Its output is sent to the client rather than the
+ * console, quitting closes only this connection, and prompts are declined since the server can't
+ * block waiting for an answer (commands can pass --yes instead).
+ */
+class ConnectionEnvironment : public Environment {
+public:
+    ConnectionEnvironment(Store *s_ptr)
+        : Environment(s_ptr)
+        , closing_(false) { }
+
+    bool confirm() override { return false; }
+    void exitSuccess() override { closing_ = true; }
+
+    inline bool isClosing() const { return closing_; }
+
+private:
+    bool closing_;
+};
+
+/**
+ * Serves queries from many clients over Unix domain and loopback TCP sockets, from a single epoll
+ * event loop. Each connection has its own environment (and so its own transaction), while plans
+ * are cached for all of them. Queries are pipelined: everything a client has sent is executed
+ * back to back, then the changes are logged and the replies sent, once for the whole batch.
+ */
+class Server {
+public:
+    Server(Store *, CommandLog *, PlanCache *);
+    ~Server();
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    void listenUnix(const std::string &);
+    void listenTcp(uint16_t);
+
+    // Serves clients until interrupted by SIGINT or SIGTERM.
+    void run();
+
+private:
+    struct Connection {
+        int fd;
+        QueryBuffer queries;
+        ConnectionEnvironment env;
+        Handler handler;
+
+        // Events the connection is registered for: EPOLLIN until the client is done sending (and
+        // not while queries are held back), and EPOLLOUT while output is pending.
+        uint32_t events;
+        bool closing;
+
+        // Queries were left unrun, as the output was over SERVER_OUTPUT_LIMIT
+        bool backlog;
+
+        // How much of the environment's output has been sent
+        std::size_t sent;
+
+        Connection(int, Store *);
+
+        inline std::size_t pendingOutput() { return env.output().size() - sent; }
+    };
+
+    Store *store_;
+    CommandLog *log_;
+    PlanCache *plans_;
+    int epollFd_;
+    std::vector<int> listenFds_;
+    std::vector<std::string> unixPaths_;
+    std::unordered_map<int, std::unique_ptr<Connection>> conns_;
+
+    void addListener_(int);
+    void accept_(int);
+    bool read_(Connection &);
+    bool serve_(Connection &);
+    bool write_(Connection &);
+    void close_(Connection &);
+    void executeQueries_(Connection &);
+};
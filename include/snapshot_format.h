@@ -0,0 +1,83 @@
+#pragma once
+
+#include "byte_reader.h"
+#include "store_value.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Versioned save files (v2 onwards):
+ *
+ *   [header][block 0][block 1]...[block n-1][index]
+ *
+ *   header:  magic, version, key count, key count per ValueType, block count, offsets of the
+ *            first block and of the index, then a CRC32C of all the preceding header bytes
+ *   block:   [payload size][record count][CRC32C of payload][payload], where the payload is a run
+ *            of whole records encoded like v1 files: [key size][key]|[value], each followed from
+ *            v3 onwards by the key's expiry: a flag byte, then its deadline if the flag is set
+ *   index:   [offset][record count] for each block, then a CRC32C of the entries
+ *
+ * Files starting with the v1 FILE_HEADER have no header fields and are a bare run of records.
+ */
+static const std::string SNAPSHOT_MAGIC = "KEPLERKV-SNAP|";
+static constexpr uint32_t SNAPSHOT_VERSION = 3;
+
+// First version whose records carry an expiry
+static constexpr uint32_t SNAPSHOT_EXPIRY_VERSION = 3;
+
+// Blocks are closed once their payload reaches this size (records never span blocks)
+static constexpr std::size_t SNAPSHOT_BLOCK_SIZE = 1 << 20;
+
+static constexpr std::size_t SNAPSHOT_NUM_TYPES = (std::size_t) ValueType::IDENTIFIER + 1;
+
+template <typename T>
+inline void appendRaw(std::vector<uint8_t> &buf, T t) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&t);
+    buf.insert(buf.end(), bytes, bytes + sizeof(T));
+}
+
+struct SnapshotHeader {
+    uint32_t version;
+    uint64_t keyCount;
+    uint64_t typeCounts[SNAPSHOT_NUM_TYPES];
+    uint64_t blockCount;
+    uint64_t dataOffset;
+    uint64_t indexOffset;
+
+    SnapshotHeader();
+
+    static std::size_t encodedSize();
+    std::vector<uint8_t> encode() const;
+
+    // Reads and checks a header, throwing if the magic, version or checksum don't match.
+    static SnapshotHeader decode(ByteReader &);
+};
+
+struct SnapshotBlockHeader {
+    uint32_t payloadSize;
+    uint32_t recordCount;
+    uint32_t crc;
+
+    static constexpr std::size_t ENCODED_SIZE = 3 * sizeof(uint32_t);
+};
+
+struct SnapshotIndexEntry {
+    uint64_t offset;
+    uint64_t recordCount;
+};
+
+// Records are [key size][key]|[value] in all formats. Expiries (a Unix time in milliseconds, or 0
+// for none) are written after them in the current one, and read separately.
+void appendSnapshotRecord(std::vector<uint8_t> &, const std::string &, const StoreValue &, int64_t);
+void readSnapshotRecord(ByteReader &, std::string &, StoreValue &);
+int64_t readSnapshotExpiry(ByteReader &);
+void skipSnapshotRecord(ByteReader &);
+
+// Reads the index a header points to, checking its checksum.
+std::vector<SnapshotIndexEntry> readSnapshotIndex(
+    const char *, std::size_t, const SnapshotHeader &);
+
+// Returns a block's payload after checking it lies within the file and matches its checksum.
+ByteReader openSnapshotBlock(const char *, std::size_t, const SnapshotIndexEntry &);
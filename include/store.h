@@ -1,42 +1,399 @@
 #pragma once
 
+#include "flat_hash_map.h"
+#include "key_index.h"
+#include "pattern.h"
 #include "store_value.h"
+#include "timer_wheel.h"
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <mutex>
 #include <string>
+#include <sys/types.h>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
-static constexpr unsigned int STORE_MIN_SIZE = 256;
+// Default number of keys the Store makes room for up front (split across shards).
+static constexpr std::size_t STORE_INITIAL_CAPACITY = 256;
 
+// Number of independently locked shards (as a power of two).
+static constexpr unsigned int STORE_SHARD_BITS = 4;
+static constexpr unsigned int STORE_NUM_SHARDS = 1 << STORE_SHARD_BITS;
+
+// Deadline of a key that never expires.
+static constexpr int64_t NO_EXPIRY = 0;
+
+// Minimum time between two rounds of active expiry, and the most keys each shard reclaims per round
+// (the rest wait for the next one, reading as missing in the meantime).
+static constexpr int64_t STORE_EXPIRE_CYCLE_MS = 100;
+static constexpr std::size_t STORE_EXPIRE_CYCLE_KEYS = 1024;
+
+// Keys sampled per eviction, and how many of the best candidates seen are kept for the next ones.
+static constexpr std::size_t STORE_EVICTION_SAMPLES = 5;
+static constexpr std::size_t STORE_EVICTION_POOL = 16;
+
+// LFU counters are logarithmic: each access bumps one at `c` with a chance of 1 / ((c - initial) *
+// factor + 1), so it takes about a million to saturate. They drop by one per idle period.
+static constexpr uint8_t STORE_LFU_INITIAL = 5;
+static constexpr unsigned int STORE_LFU_LOG_FACTOR = 10;
+static constexpr int64_t STORE_LFU_DECAY_MS = 60 * 1000;
+
+// Most alias chains whose ends are cached, and the chain length past which cycles are looked for
+// with a hash set rather than by going over the aliases seen.
+static constexpr std::size_t STORE_ALIAS_CACHE_SIZE = 1 << 16;
+static constexpr std::size_t STORE_ALIAS_LINEAR_HOPS = 16;
+
+// Keys a SCAN (or paged LIST) visits when not told how many.
+static constexpr std::size_t STORE_SCAN_COUNT = 10;
+
+using ShardLock = std::lock_guard<std::mutex>;
+
+class ByteReader;
+
+// Outcome of modifying a stored value in place.
+enum class StoreResult { OK, NOT_FOUND, WRONG_TYPE, OUT_OF_RANGE };
+
+// Which keys make room once the Store is over its memory cap: the least recently or least
+// frequently used, out of all keys or only those with a deadline. Or none, refusing writes instead.
+enum class EvictionPolicy { NOEVICTION, ALLKEYS_LRU, ALLKEYS_LFU, VOLATILE_LRU, VOLATILE_LFU };
+
+// Policies go by the names noeviction, allkeys-lru, allkeys-lfu, volatile-lru and volatile-lfu.
+bool parseEvictionPolicy(const std::string &, EvictionPolicy &);
+const char *evictionPolicyName(EvictionPolicy);
+
+// State of the most recent background save.
+struct BackgroundSaveInfo {
+    enum class State { NONE, RUNNING, DONE, FAILED };
+
+    State state = State::NONE;
+    std::string filename;
+    uint64_t bytes = 0;
+    uint64_t durationMs = 0;
+};
+
+/**
+ * The Store is split into shards selected by key hash, each guarded by its own mutex.
+ * Single-key operations only lock the shard owning that key, so commands on different
+ * keys from different threads can run in parallel.
+ *
+ * Keys can be given a deadline (a Unix time in milliseconds), kept in a map of their own next to
+ * the values and scheduled on the shard's timer wheel. Once past it a key reads as missing, and is
+ * reclaimed by the next write to it or by activeExpire(), whichever comes first. Until then it
+ * still counts towards size().
+ *
+ * Memory is accounted for as items change: each takes up a table slot, plus whatever its key and
+ * value hold on the heap (list items included), and a key's deadline its own slot plus its entries
+ * on the timer wheel. The alias cache and the lists of which keys refer to which are counted too,
+ * entry by entry. Past the cap, evict() removes keys picked by sampling a few at a time and
+ * keeping the best candidates seen in a small pool, which approximates the policy at a constant
+ * cost per eviction. The access stats it needs live in a spare word of each slot, and are only
+ * kept up to date while a policy needs them.
+ *
+ * Each shard also keeps its keys in order in a KeyIndex, for searches by prefix or range.
+ *
+ * Alias chains followed to their end are cached, from the first alias to the key the chain ends
+ * at, so following the chain again costs one jump. Each key on a cached chain lists the aliases
+ * whose chains run through it, so that writing an alias (or turning a key into one) only drops
+ * the chains it was on. A chain followed while another was dropped isn't cached, as it may have
+ * been read before the change. A chain through aliases with deadlines is only jumped over until the
+ * soonest of them, and giving an alias a deadline drops the chains through it.
+ *
+ * Each shard also keeps, for its keys, which keys refer to them: as an alias or from a list item
+ * (nested lists included). It is kept up to date as values are written, so the keys referring to
+ * one are found, or renamed along with it, in time proportional to how many there are.
+ */
 class Store {
 public:
-    Store();
+    using ItemVisitor = std::function<void(const std::string &, const StoreValue &)>;
+    using LoadVisitor
+        = std::function<void(const std::string &, const StoreValue &, int64_t expiresAt)>;
+
+    explicit Store(std::size_t initialCapacity = STORE_INITIAL_CAPACITY);
+
+    Store(const Store &) = delete;
+    Store &operator=(const Store &) = delete;
 
-    void set(const std::string &, StoreValueSP);
-    StoreValueSP get(const std::string &) const;
+    // Setting a key replaces its deadline, clearing it by default.
+    void set(const std::string &, StoreValue, int64_t expiresAt = NO_EXPIRY);
+    void set(std::string &&, StoreValue, int64_t expiresAt = NO_EXPIRY);
+    StoreValue get(const std::string &) const;
     bool del(const std::string &);
-    bool update(const std::string &, StoreValueSP);
-    StoreValueSP resolve(const std::string &, bool resolveIdentsInList = false) const;
-    void rename(const std::string &, const std::string &);
-    std::vector<std::string> search(const std::string &) const;
+    bool update(const std::string &, StoreValue);
+    StoreValue resolve(const std::string &, bool resolveIdentsInList = false) const;
+
+    // Batched GET and SET. Keys are hashed up front and grouped by shard, so each shard is locked
+    // once and all of its buckets are prefetched before the first is probed. getMany fills the
+    // values in the keys' order (nil if missing); setMany moves the keys and values in, later
+    // duplicates winning as with one set() after another.
+    void getMany(const std::vector<const std::string *> &, std::vector<StoreValue> &) const;
+    void setMany(
+        std::vector<std::string> &, std::vector<StoreValue> &, int64_t expiresAt = NO_EXPIRY);
+
+    // With `cascade`, the references to the old name (see referrers()) are then changed to the
+    // new one. References made to the old name while the rename runs may be left out.
+    void rename(const std::string &, const std::string &, bool cascade = false);
+
+    // Keys whose value refers to a key, as an alias or from a list, in order.
+    std::vector<std::string> referrers(const std::string &) const;
+
+    // Keys matching a regex or glob, in order. Only the keys starting with the literal text the
+    // pattern begins with (if any) are looked at, found through the ordered index.
+    std::vector<std::string> search(
+        const std::string &, PatternSyntax = PatternSyntax::REGEX) const;
+
+    // Keys starting with a prefix, and keys between two bounds (both included), in order.
+    std::vector<std::string> searchPrefix(const std::string &) const;
+    std::vector<std::string> searchRange(const std::string &from, const std::string &to) const;
+
+    // Visits the next `count` keys in order after `cursor` (from the first key if it is empty),
+    // adding those matching a glob (if not empty) to `keys`. Returns the cursor to carry on from,
+    // empty once every key was visited (or `cursor` itself for a count of 0, which visits none).
+    // Keys present for the whole scan are visited exactly once, however the store changes or
+    // grows in between.
+    std::string scan(const std::string &cursor, std::size_t count, std::vector<std::string> &keys,
+        const std::string &match = "") const;
+
+    // Modify the value at the end of a key's alias chain, under that key's shard lock.
+    StoreResult incr(const std::string &);
+    StoreResult decr(const std::string &);
+    StoreResult append(const std::string &, StoreValue);
+    StoreResult prepend(const std::string &, StoreValue);
+    StoreResult popFront(const std::string &, StoreValue &);
+    StoreResult popBack(const std::string &, StoreValue &);
+    StoreResult trim(const std::string &, long start, long stop);
+
+    // Copy out one item, or an inclusive range of them as a list, from the list at the end of a
+    // key's alias chain. Negative indexes count back from the end.
+    StoreResult index(const std::string &, long, StoreValue &) const;
+    StoreResult range(const std::string &, long start, long stop, StoreValue &) const;
 
     bool contains(const std::string &key) const;
 
+    // Expiry. expireAt and persist return false if the key is missing, ttl returns the time left in
+    // milliseconds, or -1 if the key has no deadline and -2 if it is missing.
+    bool expireAt(const std::string &, int64_t);
+    bool persist(const std::string &);
+    int64_t ttl(const std::string &) const;
+
+    // Reclaims keys past their deadline, at most once every STORE_EXPIRE_CYCLE_MS. Cheap to call
+    // often: it returns straight away if no key has a deadline. Returns how many were reclaimed.
+    std::size_t activeExpire();
+
+    inline std::size_t expiringSize() const { return expiring_.load(std::memory_order_relaxed); }
+
+    static int64_t nowMs();
+
+    // Memory cap in bytes, or 0 for none. Set up front, before the Store is shared between threads.
+    void setMaxMemory(std::size_t, EvictionPolicy);
+    inline std::size_t maxMemory() const { return maxMemory_; }
+    inline EvictionPolicy evictionPolicy() const { return policy_; }
+    inline std::size_t usedMemory() const { return memory_.load(std::memory_order_relaxed); }
+    inline std::size_t evictedKeys() const { return evicted_.load(std::memory_order_relaxed); }
+    inline bool overMemoryLimit() const { return maxMemory_ && usedMemory() > maxMemory_; }
+
+    // Evicts keys until memory use is back under the cap, appending them to `evicted`. Returns
+    // false if it can't get there: the policy is noeviction, or no key is left it may evict.
+    bool evict(std::vector<std::string> &evicted);
+
+    // Bytes an item takes up in the Store, and that a key's deadline adds.
+    static std::size_t itemMemory(const std::string &, const StoreValue &);
+    static std::size_t deadlineMemory(const std::string &);
+
     void saveToFile(const std::string &) const;
-    void loadFromFile(const std::string &);
+    void saveToStream(std::ostream &) const;
 
-    inline size_t size() const { return map_.size(); }
+    // Loads call `visit` (if given) on every item they bring in, once the whole file checked out
+    // and before any item is merged.
+    void loadFromFile(const std::string &, const LoadVisitor &visit = nullptr);
+    void loadFromBytes(const char *, std::size_t, const LoadVisitor &visit = nullptr);
 
-    std::unordered_map<std::string, StoreValueSP>::iterator begin() { return map_.begin(); }
-    std::unordered_map<std::string, StoreValueSP>::const_iterator begin() const {
-        return map_.begin();
-    }
-    std::unordered_map<std::string, StoreValueSP>::iterator end() { return map_.end(); }
-    std::unordered_map<std::string, StoreValueSP>::const_iterator end() const { return map_.end(); }
+    // Forks the process, giving the child (where this returns 0) a consistent image of the Store.
+    pid_t forkSnapshot();
+
+    // Forks a child that saves a copy-on-write image of the Store while this process carries on.
+    // Only one background save runs at a time.
+    void saveToFileInBackground(const std::string &);
+
+    // Collects a finished background save, if any, and reports on the latest one.
+    const BackgroundSaveInfo &backgroundSaveInfo();
+
+    inline size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+    // Makes room for at least `n` keys in total without further resizing.
+    void reserve(std::size_t n);
+
+    // Visits every item, one shard at a time. Each shard stays locked while it is traversed,
+    // so the visitor sees a consistent view of that shard but must not call back into the Store.
+    void forEach(const ItemVisitor &) const;
 
 private:
-    std::unordered_map<std::string, StoreValueSP> map_;
+    struct Shard {
+        mutable std::mutex mtx;
+        FlatHashMap<StoreValue> map;
+        FlatHashMap<int64_t> expires;
+        TimerWheel wheel;
+        KeyIndex index;
+
+        // Keys of this shard to the keys referring to them, with how many times each does. Guarded
+        // by refsMtx rather than mtx, as it changes with writes to the referring keys, which may
+        // be in any shard.
+        mutable std::mutex refsMtx;
+        std::unordered_map<std::string, std::unordered_map<std::string, uint32_t>> refs;
+    };
+
+    using Slot = FlatHashMap<StoreValue>::Slot;
+
+    std::array<Shard, STORE_NUM_SHARDS> shards_;
+    std::atomic<size_t> size_;
+    std::atomic<size_t> expiring_;
+    std::atomic<int64_t> lastExpireCycle_;
+
+    std::atomic<size_t> memory_;
+    std::size_t maxMemory_;
+    EvictionPolicy policy_;
+    std::atomic<size_t> evicted_;
+
+    // Candidates for eviction, from the least to the most deserving
+    struct EvictionCandidate {
+        uint64_t score;
+        std::size_t hash;
+        std::string key;
+    };
+    std::mutex evictMtx_;
+    std::vector<EvictionCandidate> evictionPool_;
+    std::size_t evictCursor_;
+
+    mutable PatternCache patterns_;
+
+    // Alias to the key its chain ends at, with the keys the chain went through and the soonest
+    // deadline among them
+    struct AliasTarget {
+        std::string key;
+        std::vector<std::string> chain;
+        int64_t expiresAt;
+    };
+    std::mutex aliasMtx_;
+    std::unordered_map<std::string, AliasTarget> aliasTargets_;
+    std::unordered_map<std::string, std::unordered_set<std::string>> aliasesThrough_;
+    std::atomic<uint64_t> aliasEpoch_;
+    std::size_t aliasMemory_;
+
+    pid_t bgSavePid_;
+    int bgSavePipe_;
+    BackgroundSaveInfo bgSave_;
+
+    static inline std::size_t hashKey_(const std::string &key) {
+        return std::hash<std::string>()(key);
+    }
+
+    // Shards are picked by the top bits of the hash, the flat map probes with the lower ones
+    static inline std::size_t shardIndex_(std::size_t hash) {
+        return (hash >> (sizeof(std::size_t) * 8 - STORE_SHARD_BITS)) & (STORE_NUM_SHARDS - 1);
+    }
+    inline Shard &shardFor_(std::size_t hash) { return shards_[shardIndex_(hash)]; }
+    inline const Shard &shardFor_(std::size_t hash) const {
+        return const_cast<Store *>(this)->shardFor_(hash);
+    }
 
-    StoreValueSP resolveRecur_(const std::string &, std::unordered_set<std::string> &,
-        bool resolveIdentsInList = false) const;
+    // Where each shard's run of a batch begins in the order groupByShard_ puts it in
+    using ShardRuns = std::array<std::size_t, STORE_NUM_SHARDS + 1>;
+    static void groupByShard_(
+        const std::vector<std::size_t> &, std::vector<std::size_t> &, ShardRuns &);
+
+    // Expiry helpers, called with the shard locked
+    bool isExpired_(const Shard &, const std::string &, std::size_t) const;
+    int64_t expiryOf_(const Shard &, const std::string &, std::size_t) const;
+    void setExpiry_(Shard &, const std::string &, std::size_t, int64_t);
+    void clearExpiry_(Shard &, const std::string &, std::size_t);
+    bool reclaimIfExpired_(Shard &, const std::string &, std::size_t, int64_t now = -1);
+
+    // Memory and access helpers, called with the shard locked. assign_ moves a value into a slot
+    // (new or not) and removeSlot_ erases one, both keeping the memory count and key index.
+    // resized_ accounts for a value changed in place, given its size before.
+    void assign_(Shard &, Slot &, StoreValue &&, bool inserted);
+    void removeSlot_(Shard &, Slot *, StoreValue *out = nullptr);
+    void resized_(const StoreValue &, std::size_t before);
+    void touch_(Slot &, bool inserted) const;
+
+    inline bool tracksAccess_() const {
+        return maxMemory_ && policy_ != EvictionPolicy::NOEVICTION;
+    }
+    uint64_t evictionScore_(const Slot &, int64_t now) const;
+    void sampleForEviction_(Shard &);
+    void addCandidate_(uint64_t score, const Slot &);
+    bool evictCandidate_(const EvictionCandidate &);
+
+    // Reference helpers, called with the referring key's shard locked. addRefs_ and dropRefs_ go
+    // over all the references a value makes.
+    void addRefs_(const std::string &referrer, const StoreValue &);
+    void dropRefs_(const std::string &referrer, const StoreValue &);
+    void addRef_(const std::string &referrer, const std::string &target);
+    void dropRef_(const std::string &referrer, const std::string &target);
+    std::vector<std::string> referrersOf_(const std::string &) const;
+
+    bool moveKey_(const std::string &, const std::string &);
+    void retargetRefs_(const std::string &from, const std::string &to);
+
+    template <typename F>
+    void forEach_(F &&) const;
+
+    template <typename InRange>
+    std::vector<std::string> scanKeys_(const std::string &from, InRange, const Pattern *) const;
+
+    StoreValue resolveRecur_(
+        const std::string &, std::vector<std::string> &lists, bool resolveIdentsInList) const;
+
+    template <typename F>
+    StoreResult modifyResolved_(const std::string &, F, std::string *resolvedKey = nullptr);
+
+    // Alias cache helpers. The shard of the key passed to invalidateAliases_ must be locked.
+    bool cachedAlias_(const std::string &alias, std::string &target);
+    void cacheAlias_(std::vector<std::string> &chain, const std::string &target, int64_t expiresAt,
+        uint64_t epoch);
+    void invalidateAliases_(const std::string &key);
+    void dropAlias_(const std::string &alias);
+
+    // An item decoded from a save file, waiting to be merged into its shard
+    struct LoadedItem {
+        std::size_t hash;
+        std::string key;
+        StoreValue value;
+        int64_t expiresAt = NO_EXPIRY;
+    };
+
+    void reapBackgroundSave_(bool wait);
+
+    void loadItem_(std::string &&, StoreValue &&, int64_t expiresAt);
+    long loadIntoShard_(Shard &, LoadedItem &, int64_t now);
+    void loadBatch_(std::size_t, std::vector<LoadedItem> &);
+    void loadV1_(ByteReader &, const LoadVisitor &);
+    void loadV2_(const char *, std::size_t, const LoadVisitor &);
 };
+
+// Calls f(key, value, expiresAt) on every item not past its deadline, one shard at a time.
+template <typename F>
+void Store::forEach_(F &&f) const {
+    int64_t now = nowMs();
+    for (const Shard &shard : shards_) {
+        ShardLock lock(shard.mtx);
+        if (shard.expires.empty()) {
+            shard.map.forEach([&f](const std::string &key, const StoreValue &value) {
+                f(key, value, NO_EXPIRY);
+            });
+            continue;
+        }
+
+        shard.map.forEach([&](const std::string &key, const StoreValue &value) {
+            const int64_t *expiresAt = shard.expires.find(key, hashKey_(key));
+            if (!expiresAt)
+                f(key, value, NO_EXPIRY);
+            else if (*expiresAt > now)
+                f(key, value, *expiresAt);
+        });
+    }
+}
@@ -1,149 +1,197 @@
 #pragma once
 
-#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iosfwd>
 #include <string>
+#include <utility>
 #include <vector>
 
-enum class ValueType { INT, FLOAT, STRING, LIST, IDENTIFIER };
+enum class ValueType : uint8_t { NIL, INT, FLOAT, STRING, LIST, IDENTIFIER };
 
+class ByteReader;
+class ListValue;
 class StoreValue;
-using StoreValueSP = std::shared_ptr<StoreValue>;
 
+// A deque, so lists take pushes and pops at either end in constant time (they double as queues).
+using ListItems = std::deque<StoreValue>;
+
+/**
+ * A value held in the Store, stored as a 16-byte tagged union. Integers, floats and strings of up
+ * to INLINE_CAPACITY bytes live inside the value itself; only longer strings and lists own a heap
+ * allocation. Values have plain value semantics (copies are deep), and a default-constructed value
+ * is nil, standing in for "no value".
+ */
 class StoreValue {
 public:
-    virtual ~StoreValue() = default;
+    static constexpr std::size_t INLINE_CAPACITY = 14;
+
+    StoreValue()
+        : type_(ValueType::NIL)
+        , inlineLen_(0) { }
+    StoreValue(int i)
+        : type_(ValueType::INT)
+        , inlineLen_(0) {
+        std::memcpy(data_, &i, sizeof(i));
+    }
+    StoreValue(float f)
+        : type_(ValueType::FLOAT)
+        , inlineLen_(0) {
+        std::memcpy(data_, &f, sizeof(f));
+    }
+
+    static StoreValue makeString(std::string s) { return StoreValue(ValueType::STRING, s); }
+    static StoreValue makeIdentifier(std::string s) { return StoreValue(ValueType::IDENTIFIER, s); }
+    static StoreValue makeString(const char *s, std::size_t n) {
+        return StoreValue(ValueType::STRING, s, n);
+    }
+    static StoreValue makeIdentifier(const char *s, std::size_t n) {
+        return StoreValue(ValueType::IDENTIFIER, s, n);
+    }
+    static StoreValue makeList(ListItems &&);
+
+    StoreValue(const StoreValue &);
+    StoreValue(StoreValue &&) noexcept;
+    StoreValue &operator=(const StoreValue &);
+    StoreValue &operator=(StoreValue &&) noexcept;
+    ~StoreValue();
 
     /* Values are serialized by type identifier, size of the value, then raw data.
     * ex. a string "abc" may be stored as s|4|abc
     */
-    virtual std::vector<uint8_t> serialize() const = 0;
-    virtual void deserialize(std::ifstream &) = 0;
-
+    std::vector<uint8_t> serialize() const;
+    void serializeInto(std::vector<uint8_t> &) const;
     void toFile(std::ofstream &) const;
-    static StoreValueSP fromFile(std::ifstream &);
-
-    virtual inline ValueType getValueType() const = 0;
-    virtual std::size_t size() const = 0;
-    virtual std::string string() const = 0;
+    static StoreValue fromBytes(ByteReader &);
+    static void skipBytes(ByteReader &);
+
+    inline ValueType getValueType() const { return type_; }
+    inline bool isNil() const { return type_ == ValueType::NIL; }
+    explicit operator bool() const { return !isNil(); }
+
+    inline bool isNumeric() const { return type_ == ValueType::INT || type_ == ValueType::FLOAT; }
+    inline bool isString() const {
+        return type_ == ValueType::STRING || type_ == ValueType::IDENTIFIER;
+    }
+
+    // Typed accessors, only meaningful when the value holds that type.
+    int getInt() const;
+    float getFloat() const;
+    std::string getString() const;
+    const char *stringData() const;
+    std::size_t stringSize() const;
+    ListValue &getList();
+    const ListValue &getList() const;
+
+    // Numeric values only, no effect on other types.
+    void incr();
+    void decr();
+
+    std::size_t size() const;
+    std::string string() const;
     friend std::ostream &operator<<(std::ostream &os, const StoreValue &s) {
         os << s.string();
         return os;
     };
-};
-
-class NumericType {
-public:
-    virtual void incr() = 0;
-    virtual void decr() = 0;
-};
-
-class IntValue : public StoreValue, public NumericType {
-public:
-    IntValue()
-        : value_(0) {};
-    IntValue(int i)
-        : value_(i) {};
-
-    int getValue() { return value_; }
-
-    std::vector<uint8_t> serialize() const override;
-    void deserialize(std::ifstream &) override;
-
-    inline ValueType getValueType() const override { return ValueType::INT; }
-    std::size_t size() const override { return sizeof(value_); }
-    std::string string() const override { return "int: " + std::to_string(value_); }
-
-    void incr() override { value_ += 1; }
-    void decr() override { value_ -= 1; }
 
 private:
-    int value_;
+    // Marks a string that did not fit inline and lives behind a pointer instead
+    static constexpr uint8_t HEAP_STRING = 0xFF;
+
+    alignas(8) char data_[INLINE_CAPACITY];
+    ValueType type_;
+    uint8_t inlineLen_;
+
+    StoreValue(ValueType, std::string &);
+    StoreValue(ValueType, const char *, std::size_t);
+
+    template <typename T>
+    inline T load_() const {
+        T t;
+        std::memcpy(&t, data_, sizeof(T));
+        return t;
+    }
+    template <typename T>
+    inline void store_(T t) {
+        std::memcpy(data_, &t, sizeof(T));
+    }
+
+    inline bool ownsHeap_() const {
+        return type_ == ValueType::LIST || (isString() && inlineLen_ == HEAP_STRING);
+    }
+    void copyHeap_(const StoreValue &);
+    void releaseHeap_();
 };
 
-class FloatValue : public StoreValue, public NumericType {
+/**
+ * Items are only changed through the methods below, which keep a running total of their sizes, so
+ * size() is constant time instead of a walk over every item.
+ */
+class ListValue {
 public:
-    FloatValue()
-        : value_(0) {};
-    FloatValue(float f)
-        : value_(f) {};
-
-    float getValue() { return value_; }
-
-    std::vector<uint8_t> serialize() const override;
-    void deserialize(std::ifstream &) override;
-
-    inline ValueType getValueType() const override { return ValueType::FLOAT; }
-    std::size_t size() const override { return sizeof(value_); }
-    std::string string() const override { return "float: " + std::to_string(value_); }
-
-    void incr() override { value_ += 1; }
-    void decr() override { value_ -= 1; }
-
-private:
-    float value_;
-};
-
-class StringValue : public StoreValue {
-public:
-    StringValue()
-        : value_("") {};
-    StringValue(std::string s)
-        : value_(s) {};
-
-    std::string &getValue() { return value_; }
-
-    std::vector<uint8_t> serialize() const override;
-    void deserialize(std::ifstream &) override;
-
-    inline ValueType getValueType() const override { return ValueType::STRING; }
-    std::size_t size() const override { return sizeof(value_); }
-    std::string string() const override { return "str: " + value_; }
-
-protected:
-    std::string value_;
-};
-
-class IdentifierValue : public StringValue {
-public:
-    IdentifierValue()
-        : StringValue() {};
-    IdentifierValue(std::string s)
-        : StringValue(s) {};
+    ListValue()
+        : itemsSize_(0) { }
+    ListValue(ListItems &&);
 
-    std::vector<uint8_t> serialize() const override;
+    const ListItems &getValue() const { return value_; }
+    inline std::size_t length() const { return value_.size(); }
 
-    inline ValueType getValueType() const override { return ValueType::IDENTIFIER; }
-    std::string string() const override { return "id: " + value_; }
-};
+    inline std::size_t size() const { return sizeof(ListValue) + itemsSize_; }
+    std::string string() const;
 
-class ListValue : public StoreValue {
-public:
-    ListValue()
-        : value_(std::vector<StoreValueSP>()) {};
-    ListValue(std::vector<StoreValueSP> &l)
-        : value_(l) {};
-    ListValue(std::vector<StoreValueSP> &&l)
-        : value_(std::move(l)) {};
+    void append(StoreValue);
+    void prepend(StoreValue);
 
-    std::vector<StoreValueSP> &getValue() { return value_; }
+    // The list must not be empty.
+    StoreValue popFront();
+    StoreValue popBack();
 
-    std::vector<uint8_t> serialize() const override;
-    void deserialize(std::ifstream &) override;
+    void replace(std::size_t, StoreValue);
 
-    inline ValueType getValueType() const override { return ValueType::LIST; }
-    std::size_t size() const override;
-    std::string string() const override;
+    // Keeps only the items in [from, to).
+    void trim(std::size_t from, std::size_t to);
 
-    void append(StoreValueSP item) { value_.push_back(item); }
-    void prepend(StoreValueSP item) { value_.insert(value_.begin(), item); }
+    // Turns an inclusive range of indexes, which count back from the end when negative, into a
+    // half-open range clamped to the list. Returns false if no item is in range.
+    bool toRange(long start, long stop, std::size_t &from, std::size_t &to) const;
 
 private:
-    std::vector<StoreValueSP> value_;
+    ListItems value_;
+    std::size_t itemsSize_;
 };
 
-using NumericTypeSP = std::shared_ptr<NumericType>;
-using IntValueSP = std::shared_ptr<IntValue>;
-using FloatValueSP = std::shared_ptr<FloatValue>;
-using StringValueSP = std::shared_ptr<StringValue>;
-using IdentifierValueSP = std::shared_ptr<IdentifierValue>;
-using ListValueSP = std::shared_ptr<ListValue>;
+inline StoreValue::StoreValue(const StoreValue &other)
+    : type_(other.type_)
+    , inlineLen_(other.inlineLen_) {
+    if (other.ownsHeap_())
+        copyHeap_(other);
+    else
+        std::memcpy(data_, other.data_, INLINE_CAPACITY);
+}
+
+inline StoreValue::StoreValue(StoreValue &&other) noexcept
+    : type_(other.type_)
+    , inlineLen_(other.inlineLen_) {
+    std::memcpy(data_, other.data_, INLINE_CAPACITY);
+    other.type_ = ValueType::NIL;
+}
+
+inline StoreValue &StoreValue::operator=(const StoreValue &other) {
+    if (this != &other) *this = StoreValue(other);
+    return *this;
+}
+
+inline StoreValue &StoreValue::operator=(StoreValue &&other) noexcept {
+    if (this == &other) return *this;
+    if (ownsHeap_()) releaseHeap_();
+    type_ = other.type_;
+    inlineLen_ = other.inlineLen_;
+    std::memcpy(data_, other.data_, INLINE_CAPACITY);
+    other.type_ = ValueType::NIL;
+    return *this;
+}
+
+inline StoreValue::~StoreValue() {
+    if (ownsHeap_()) releaseHeap_();
+}
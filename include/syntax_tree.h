@@ -21,12 +21,22 @@ enum class CommandType {
     INCR,       DECR,           APPEND,
     PREPEND,    STATS,          SEARCH,
     BEGIN,      COMMIT,         ROLLBACK,
+    COMPACT,    POPFRONT,       POPBACK,
+    INDEX,      RANGE,          TRIM,
+    EXPIRE,     TTL,            PERSIST,
+    EXPIREAT,   SCAN,           REFS,
 };
 // clang-format on
 
 enum CommandOption : uint8_t {
+    CASCADE = 1 << 0,
     YES = 1 << 1,
     NO = 1 << 2,
+    BG = 1 << 3,
+    PREFIX = 1 << 4,
+    RANGE = 1 << 5,
+    GLOB = 1 << 6,
+    COUNT = 1 << 7,
 };
 
 static const std::unordered_map<std::string, CommandType> mapToCmd = { { "SET", CommandType::SET },
@@ -41,7 +51,14 @@ static const std::unordered_map<std::string, CommandType> mapToCmd = { { "SET",
     { "DECR", CommandType::DECR }, { "APPEND", CommandType::APPEND },
     { "PREPEND", CommandType::PREPEND }, { "STATS", CommandType::STATS },
     { "SEARCH", CommandType::SEARCH }, { "BEGIN", CommandType::BEGIN },
-    { "COMMIT", CommandType::COMMIT }, { "ROLLBACK", CommandType::ROLLBACK } };
+    { "COMMIT", CommandType::COMMIT }, { "ROLLBACK", CommandType::ROLLBACK },
+    { "COMPACT", CommandType::COMPACT }, { "POPFRONT", CommandType::POPFRONT },
+    { "POPF", CommandType::POPFRONT }, { "POPBACK", CommandType::POPBACK },
+    { "POPB", CommandType::POPBACK }, { "INDEX", CommandType::INDEX },
+    { "IDX", CommandType::INDEX }, { "RANGE", CommandType::RANGE }, { "TRIM", CommandType::TRIM },
+    { "EXPIRE", CommandType::EXPIRE }, { "TTL", CommandType::TTL },
+    { "PERSIST", CommandType::PERSIST }, { "SCAN", CommandType::SCAN },
+    { "REFS", CommandType::REFS } };
 
 class ASTNode {
 public:
@@ -65,7 +82,18 @@ class Nil : public ASTNode {
 
 class Value : public ASTNode {
 public:
-    virtual StoreValueSP evaluate() const = 0;
+    virtual StoreValue evaluate() const = 0;
+
+    // Moves the value out of the node instead of copying it, leaving the node empty. Only for a
+    // command done with its arguments (a cached plan's are rebound before it runs again).
+    virtual StoreValue take() { return evaluate(); }
+
+    inline bool isIdentifier() const { return getNodeType() == NodeType::IDENTIFIER; }
+
+    // The key named by an identifier node, borrowed rather than evaluated into a copy.
+    // Only valid when isIdentifier().
+    inline const std::string &identifier() const;
+    inline std::string takeIdentifier();
 };
 
 using ValueSP = std::shared_ptr<Value>;
@@ -77,9 +105,11 @@ public:
     IntNode(int i)
         : value_(i) {};
 
+    inline void setValue(int i) { value_ = i; }
+
     inline NodeType getNodeType() const override { return NodeType::INT; }
     std::string string() const override;
-    StoreValueSP evaluate() const override;
+    StoreValue evaluate() const override;
 
 private:
     int value_;
@@ -92,9 +122,11 @@ public:
     FloatNode(float f)
         : value_(f) {};
 
+    inline void setValue(float f) { value_ = f; }
+
     inline NodeType getNodeType() const override { return NodeType::FLOAT; }
     std::string string() const override;
-    StoreValueSP evaluate() const override;
+    StoreValue evaluate() const override;
 
 private:
     float value_;
@@ -107,9 +139,13 @@ public:
     StringNode(std::string s)
         : value_(s) {};
 
+    inline void setValue(const char *s, std::size_t len) { value_.assign(s, len); }
+    inline const std::string &getValue() const { return value_; }
+
     inline NodeType getNodeType() const override { return NodeType::STRING; }
     std::string string() const override;
-    StoreValueSP evaluate() const override;
+    StoreValue evaluate() const override;
+    StoreValue take() override;
 
 protected:
     std::string value_;
@@ -124,9 +160,20 @@ public:
 
     inline NodeType getNodeType() const override { return NodeType::IDENTIFIER; }
     std::string string() const override;
-    StoreValueSP evaluate() const override;
+    StoreValue evaluate() const override;
+    StoreValue take() override;
+
+    inline std::string takeValue() { return std::move(value_); }
 };
 
+// Identifiers are always IdentifierNodes, whatever built them.
+inline const std::string &Value::identifier() const {
+    return static_cast<const IdentifierNode *>(this)->getValue();
+}
+inline std::string Value::takeIdentifier() {
+    return static_cast<IdentifierNode *>(this)->takeValue();
+}
+
 class ListNode : public Value {
 public:
     ListNode()
@@ -138,12 +185,29 @@ public:
 
     inline NodeType getNodeType() const override { return NodeType::LIST; }
     std::string string() const override;
-    StoreValueSP evaluate() const override;
+    StoreValue evaluate() const override;
+    StoreValue take() override;
 
 private:
     std::vector<ValueSP> value_;
 };
 
+// Holds an already evaluated value, for rebuilding commands outside of the parser. Identifiers are
+// rebuilt as IdentifierNodes instead, so their keys can be borrowed.
+class LiteralNode : public Value {
+public:
+    LiteralNode(StoreValue v)
+        : value_(std::move(v)) {};
+
+    NodeType getNodeType() const override;
+    std::string string() const override;
+    StoreValue evaluate() const override { return value_; }
+    StoreValue take() override { return std::move(value_); }
+
+private:
+    StoreValue value_;
+};
+
 class Command : public ASTNode {
 public:
     Command()
@@ -164,22 +228,45 @@ public:
 
     inline CommandType getCmdType() const { return cmdType_; }
 
+    // Whether this is a SystemCommand rather than a StoreCommand, so callers can dispatch without
+    // RTTI
+    inline bool isSystemCommand() const { return isSystem_; }
+
     inline bool hasOption(CommandOption op) const { return (options_ & op) != 0; }
     inline void setOption(CommandOption op) { options_ |= op; }
     inline void clearOptions() { options_ = 0; }
+    inline uint8_t getOptions() const { return options_; }
+
+    // The duration given with --ttl, if any: an amount, and the unit written right after it
+    inline void setTtl(ValueSP amount, ValueSP unit) {
+        ttl_ = std::move(amount);
+        ttlUnit_ = std::move(unit);
+    }
+    inline const ValueSP &getTtl() const { return ttl_; }
+    inline const ValueSP &getTtlUnit() const { return ttlUnit_; }
 
     inline void addArg(ValueSP &a) { args_.push_back(std::move(a)); }
     inline std::vector<ValueSP> &getArgs() { return args_; }
+    inline const std::vector<ValueSP> &getArgs() const { return args_; }
     inline std::size_t numArgs() const { return args_.size(); }
 
     // Validates the syntax and semantics of a command.
     // Not all commands have syntax to validate, so default returns true.
     virtual bool validate() const { return true; }
 
+    // Validates what depends on the values of the command's literals, rather than on its shape.
+    // A cached plan's commands only need this checking again once rebound to new values.
+    virtual bool validateValues() const { return true; }
+
+    inline bool isValid() const { return validate() && validateValues(); }
+
 protected:
     const CommandType cmdType_;
     std::vector<ValueSP> args_;
     uint8_t options_;
+    bool isSystem_ = false;
+    ValueSP ttl_;
+    ValueSP ttlUnit_;
 };
 
 class EnvironmentInterface; // Forward declaration
@@ -216,11 +303,17 @@ protected:
 class SystemCommand : public Command {
 public:
     SystemCommand()
-        : Command() { }
+        : Command() {
+        isSystem_ = true;
+    }
     SystemCommand(const std::string &c)
-        : Command(c) { }
+        : Command(c) {
+        isSystem_ = true;
+    }
     SystemCommand(const CommandType &c)
-        : Command(c) { }
+        : Command(c) {
+        isSystem_ = true;
+    }
 
     // execute() assumes the node has been validated.
     // Executing non-validated nodes can have undefined behavior.
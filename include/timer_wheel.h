@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Number of wheels, and of slots in each (as a power of two). The first wheel has a slot per
+// millisecond, and each wheel's slots span as much time as the whole wheel below it.
+static constexpr unsigned int TIMER_WHEEL_LEVELS = 4;
+static constexpr unsigned int TIMER_WHEEL_SLOT_BITS = 6;
+static constexpr unsigned int TIMER_WHEEL_SLOTS = 1 << TIMER_WHEEL_SLOT_BITS;
+
+/**
+ * Hierarchical timer wheel of key deadlines, in milliseconds. A deadline goes into a slot of the
+ * lowest wheel able to reach it, and as time comes to a slot of a higher wheel, its deadlines are
+ * cascaded down into the finer wheels until they fall due from the first one. Scheduling takes
+ * constant time, and advancing the clock only costs a step per 64 ms without deadlines, plus one
+ * per deadline moved, instead of a scan over every key.
+ *
+ * Deadlines further out than the top wheel reaches park in its farthest slot and cascade from
+ * there as many times as needed. Entries are never cancelled, so whoever advances the wheel checks
+ * each due entry against the key, whose deadline may have changed since.
+ */
+class TimerWheel {
+public:
+    struct Entry {
+        int64_t deadline;
+        std::size_t hash;
+        std::string key;
+    };
+
+    explicit TimerWheel(int64_t now = 0);
+
+    // Deadlines already past fall due on the next advance.
+    void schedule(std::string key, std::size_t hash, int64_t deadline);
+
+    // Moves the clock forward to `now`, appending the entries that fell due to `due`.
+    void advance(int64_t now, std::vector<Entry> &due);
+
+    // Entries scheduled and not yet due, including those of keys whose deadline has since changed,
+    // and the bytes they take up
+    inline std::size_t size() const { return size_; }
+    inline std::size_t bytes() const { return bytes_; }
+
+private:
+    std::vector<Entry> slots_[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t occupied_[TIMER_WHEEL_LEVELS];
+    int64_t now_;
+    std::size_t size_;
+    std::size_t bytes_;
+
+    void insert_(Entry &&, int64_t earliest);
+    void cascade_();
+};
@@ -1,7 +1,6 @@
 #pragma once
 
-#include <memory>
-#include <ostream>
+#include <cstdint>
 #include <string>
 
 enum class TokenType {
@@ -17,27 +16,20 @@ enum class TokenType {
     UNKNOWN
 };
 
+/**
+ * A token is only a span of the query it was lexed from, so lexing never copies the query or
+ * allocates per token. The query has to outlive its tokens.
+ */
 struct Token {
-    const TokenType type;
-    std::string value;
+    TokenType type;
+    uint32_t offset;
+    uint32_t len;
 
-    Token()
-        : type(TokenType::UNKNOWN)
-        , value("") {};
-    Token(const TokenType &type)
-        : type(type)
-        , value("") {};
-    Token(const TokenType &type, const std::string &s)
-        : type(type)
-        , value(s) {};
-    Token(const TokenType &type, std::string &&s)
-        : type(type)
-        , value(std::move(s)) {};
-    Token(const TokenType &type, char c)
-        : type(type)
-        , value(std::string(1, c)) {};
+    inline std::string text(const std::string &query) const {
+        return std::string(query.data() + offset, len);
+    }
 
-    std::string string() const {
+    std::string string(const std::string &query) const {
         std::string s = "{token: ";
         switch (type) {
             case TokenType::COMMAND: s += "CMD"; break;
@@ -52,14 +44,7 @@ struct Token {
             case TokenType::UNKNOWN:
             default: s += "UNKNOWN"; break;
         }
-        s += ", value: `" + value + "`}";
+        s += ", value: `" + text(query) + "`}";
         return s;
     }
-
-    friend std::ostream &operator<<(std::ostream &os, const Token &t) {
-        os << t.string();
-        return os;
-    };
 };
-
-using TokenSP = std::shared_ptr<Token>;
@@ -0,0 +1,88 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <new>
+
+static constexpr std::size_t ALIGNMENT = alignof(std::max_align_t);
+
+static inline std::size_t alignUp(std::size_t n) { return (n + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+
+Arena::Arena(Arena &&other)
+    : blocks_(std::move(other.blocks_))
+    , current_(other.current_) {
+    other.blocks_.clear();
+    other.current_ = 0;
+}
+
+Arena &Arena::operator=(Arena &&other) {
+    if (this != &other) {
+        release_();
+        blocks_ = std::move(other.blocks_);
+        current_ = other.current_;
+        other.blocks_.clear();
+        other.current_ = 0;
+    }
+    return *this;
+}
+
+void *Arena::allocate(std::size_t n) {
+    std::size_t size = sizeof(Header) + alignUp(n);
+
+    // Move on through the blocks kept from before the last reset, then add new ones
+    while (current_ < blocks_.size()
+        && blocks_[current_]->capacity - blocks_[current_]->used < size)
+        current_++;
+    if (current_ == blocks_.size()) blocks_.push_back(newBlock_(std::max(size, ARENA_BLOCK_SIZE)));
+
+    Block *block = blocks_[current_];
+    Header *header = reinterpret_cast<Header *>(block->data() + block->used);
+    header->block = block;
+    block->used += size;
+    block->live++;
+    return header + 1;
+}
+
+void Arena::deallocate(void *p) {
+    Block *block = (static_cast<Header *>(p) - 1)->block;
+    if (--block->live == 0 && block->retired) ::operator delete(block);
+}
+
+void Arena::reset() {
+    std::size_t kept = 0;
+    std::size_t retained = 0;
+    for (Block *block : blocks_) {
+        if (block->live > 0 || retained + block->capacity > ARENA_RETAIN_SIZE) {
+            retire_(block);
+            continue;
+        }
+        block->used = 0;
+        retained += block->capacity;
+        blocks_[kept++] = block;
+    }
+    blocks_.resize(kept);
+    current_ = 0;
+}
+
+Arena::Block *Arena::newBlock_(std::size_t capacity) {
+    Block *block = static_cast<Block *>(::operator new(sizeof(Block) + capacity));
+    block->capacity = capacity;
+    block->used = 0;
+    block->live = 0;
+    block->retired = false;
+    return block;
+}
+
+// Frees a block now if nothing in it is alive, otherwise once the last allocation in it is freed.
+void Arena::retire_(Block *block) {
+    if (block->live == 0)
+        ::operator delete(block);
+    else
+        block->retired = true;
+}
+
+void Arena::release_() {
+    for (Block *block : blocks_)
+        retire_(block);
+    blocks_.clear();
+    current_ = 0;
+}
@@ -3,9 +3,12 @@
 #include "environment_interface.h"
 #include "error_msgs.h"
 #include "file_io_macros.h"
+#include "plan_cache.h"
 #include "syntax_tree.h"
 #include "terminal_colors.h"
 
+#include <algorithm>
+#include <cctype>
 #include <iostream>
 
 #define PRINT_ITEM(id, valStr) T_BBLUE + id + T_RESET + " | " + valStr
@@ -15,13 +18,97 @@
 
 // Filenames may have been passed in deliminated as strings
 std::string getFilename_(const ValueSP node) {
-    std::string &filename = DEFAULT_SAVE_FILE;
+    StoreValue fnValue = node->evaluate();
+    if (!fnValue.isString()) throw RuntimeErr(INVALID_FNAME);
+    std::string filename = fnValue.getString();
+
+    return fnValue.getValueType() == ValueType::IDENTIFIER ? filename : removeQuotations(filename);
+}
+
+// When a command stops partway, logs only the leading arguments that took effect. Every logged
+// command needs at least two arguments, so nothing is logged if none did.
+static void logPartial(EnvironmentInterface &e, const Command &cmd, std::size_t numArgs) {
+    if (numArgs >= 2) e.logCommand(cmd, numArgs);
+}
+
+// Converts a duration to milliseconds, returning 0 unless it is a positive integer amount followed
+// by a known unit (seconds when there is none).
+static int64_t durationMs(const ValueSP &amount, const ValueSP &unit) {
+    if (!amount || amount->getNodeType() != NodeType::INT) return 0;
+    int64_t n = amount->evaluate().getInt();
+    if (n <= 0) return 0;
+    if (!unit) return n * 1000;
+    if (!unit->isIdentifier()) return 0;
+
+    std::string u = unit->identifier();
+    std::transform(u.begin(), u.end(), u.begin(), ::tolower);
+    if (u == "ms") return n;
+    if (u == "s") return n * 1000;
+    if (u == "m") return n * 60 * 1000;
+    if (u == "h") return n * 60 * 60 * 1000;
+    if (u == "d") return n * 24 * 60 * 60 * 1000;
+    return 0;
+}
 
-    StringValueSP fnNode = std::dynamic_pointer_cast<StringValue>(node);
-    if (!fnNode) throw RuntimeErr(INVALID_FNAME);
-    filename = fnNode->getValue();
+// Logs a key's deadline as an EXPIREAT command. The deadline is written as a string, since integer
+// values are only 32 bits wide.
+static void logExpireAt(EnvironmentInterface &e, const std::string &key, int64_t expiresAt) {
+    ExpireAtCommand cmd;
+    ValueSP arg = std::make_shared<IdentifierNode>(key);
+    cmd.addArg(arg);
+    arg = std::make_shared<LiteralNode>(StoreValue::makeString(std::to_string(expiresAt)));
+    cmd.addArg(arg);
+    e.logCommand(cmd, cmd.numArgs());
+}
 
-    return fnNode->getValueType() == ValueType::IDENTIFIER ? filename : removeQuotations(filename);
+// Logs an item brought in by a LOAD as a SET, followed by its deadline if it has one.
+static void logLoaded(
+    EnvironmentInterface &e, const std::string &key, const StoreValue &value, int64_t expiresAt) {
+    SetCommand cmd;
+    ValueSP arg = std::make_shared<IdentifierNode>(key);
+    cmd.addArg(arg);
+    arg = std::make_shared<LiteralNode>(value);
+    cmd.addArg(arg);
+    e.logCommand(cmd, cmd.numArgs());
+    if (expiresAt != NO_EXPIRY) logExpireAt(e, key, expiresAt);
+}
+
+CommandSP makeCommand(CommandType cmdType, Arena *arena) {
+    switch (cmdType) {
+        case CommandType::QUIT: return makeShared<QuitCommand>(arena);
+        case CommandType::CLEAR: return makeShared<ClearCommand>(arena);
+        case CommandType::SET: return makeShared<SetCommand>(arena);
+        case CommandType::GET: return makeShared<GetCommand>(arena);
+        case CommandType::LIST: return makeShared<ListCommand>(arena);
+        case CommandType::DELETE: return makeShared<DeleteCommand>(arena);
+        case CommandType::UPDATE: return makeShared<UpdateCommand>(arena);
+        case CommandType::RESOLVE: return makeShared<ResolveCommand>(arena);
+        case CommandType::SAVE: return makeShared<SaveCommand>(arena);
+        case CommandType::LOAD: return makeShared<LoadCommand>(arena);
+        case CommandType::COMPACT: return makeShared<CompactCommand>(arena);
+        case CommandType::RENAME: return makeShared<RenameCommand>(arena);
+        case CommandType::INCR: return makeShared<IncrementCommand>(arena);
+        case CommandType::DECR: return makeShared<DecrementCommand>(arena);
+        case CommandType::APPEND: return makeShared<AppendCommand>(arena);
+        case CommandType::PREPEND: return makeShared<PrependCommand>(arena);
+        case CommandType::POPFRONT: return makeShared<PopFrontCommand>(arena);
+        case CommandType::POPBACK: return makeShared<PopBackCommand>(arena);
+        case CommandType::INDEX: return makeShared<IndexCommand>(arena);
+        case CommandType::RANGE: return makeShared<RangeCommand>(arena);
+        case CommandType::TRIM: return makeShared<TrimCommand>(arena);
+        case CommandType::EXPIRE: return makeShared<ExpireCommand>(arena);
+        case CommandType::TTL: return makeShared<TtlCommand>(arena);
+        case CommandType::PERSIST: return makeShared<PersistCommand>(arena);
+        case CommandType::EXPIREAT: return makeShared<ExpireAtCommand>(arena);
+        case CommandType::SEARCH: return makeShared<SearchCommand>(arena);
+        case CommandType::SCAN: return makeShared<ScanCommand>(arena);
+        case CommandType::REFS: return makeShared<RefsCommand>(arena);
+        case CommandType::STATS: return makeShared<StatsCommand>(arena);
+        case CommandType::BEGIN: return makeShared<BeginCommand>(arena);
+        case CommandType::COMMIT: return makeShared<CommitCommand>(arena);
+        case CommandType::ROLLBACK: return makeShared<RollbackCommand>(arena);
+        default: return nullptr;
+    }
 }
 
 void QuitCommand::execute(EnvironmentInterface &e) const {
@@ -55,8 +142,7 @@ bool SetCommand::validate() const {
         if (!args_[i]) continue;
 
         // First node must be an identifier
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(args_[i]->evaluate());
-        if (!idNode) return false;
+        if (!args_[i]->isIdentifier()) return false;
 
         // Identifier must follow a value
         if (!(i + 1 < numArgs()) || !args_[i + 1]) return false;
@@ -64,16 +150,45 @@ bool SetCommand::validate() const {
     return true;
 }
 
+bool SetCommand::validateValues() const { return !ttl_ || durationMs(ttl_, ttlUnit_) > 0; }
+
+// Logged up front, as the keys and values are then moved into the store. Keys given a --ttl are
+// logged with their deadline as well, after the SET clears any they had before.
 void SetCommand::execute(EnvironmentInterface &e, Store &s) const {
+    int64_t expiresAt = NO_EXPIRY;
+    if (ttl_) expiresAt = Store::nowMs() + durationMs(ttl_, ttlUnit_);
+
+    e.logCommand(*this, numArgs());
+    if (expiresAt != NO_EXPIRY) {
+        for (std::size_t i = 0; i < numArgs(); i += 2)
+            if (args_[i]) logExpireAt(e, args_[i]->identifier(), expiresAt);
+    }
+
+    if (numArgs() == 2 && args_[0]) {
+        s.set(args_[0]->takeIdentifier(), args_[1]->take(), expiresAt);
+        e.printToConsole(OK_MSG);
+        return;
+    }
+
+    std::vector<std::string> keys;
+    std::vector<StoreValue> values;
+    keys.reserve(numArgs() / 2);
+    values.reserve(numArgs() / 2);
     for (std::size_t i = 0; i < numArgs(); i += 2) {
         if (!args_[i]) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(args_[i]->evaluate());
-        const std::string &ident = idNode->getValue();
+        keys.push_back(args_[i]->takeIdentifier());
+        values.push_back(args_[i + 1]->take());
+    }
+    if (keys.empty()) return;
+    s.setMany(keys, values, expiresAt);
 
-        s.set(ident, (args_[i + 1])->evaluate());
-        e.printToConsole(OK_MSG);
+    std::string reply;
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        if (i) reply += '\n';
+        reply += OK_MSG;
     }
+    e.printToConsole(reply);
 }
 
 bool GetCommand::validate() const {
@@ -82,32 +197,125 @@ bool GetCommand::validate() const {
     for (const ValueSP &arg : args_) {
         if (!arg) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(arg->evaluate());
-        if (!idNode) return false;
+        if (!arg->isIdentifier()) return false;
     }
     return true;
 }
 
 void GetCommand::execute(EnvironmentInterface &e, Store &s) const {
+    if (numArgs() == 1) {
+        const std::string &ident = args_[0]->identifier();
+
+        StoreValue value = s.get(ident);
+        e.printToConsole(value ? PRINT_ITEM(ident, value.string()) : NOT_FOUND_MSG);
+        return;
+    }
+
+    std::vector<const std::string *> keys;
+    keys.reserve(numArgs());
     for (const ValueSP &arg : args_) {
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(arg->evaluate());
-        const std::string &ident = idNode->getValue();
+        if (!arg) continue;
 
-        StoreValueSP value = s.get(ident);
-        if (value) {
+        keys.push_back(&arg->identifier());
+    }
+
+    if (keys.empty()) return;
 
-            e.printToConsole(PRINT_ITEM(ident, value->string()));
+    std::vector<StoreValue> values;
+    s.getMany(keys, values);
+
+    std::string reply;
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        if (i) reply += '\n';
+        if (values[i])
+            reply += PRINT_ITEM(*keys[i], values[i].string());
+        else
+            reply += NOT_FOUND_MSG;
+    }
+    e.printToConsole(reply);
+}
+
+// Patterns, prefixes, bounds and cursors may be given as identifiers or strings
+static std::string searchArg(const ValueSP &arg) {
+    return arg->isIdentifier() ? arg->identifier() : removeQuotations(arg->evaluate().getString());
+}
+
+// Where a SCAN or paged LIST starts after, how many keys it visits, and the glob keys must match
+struct PageArgs {
+    std::string cursor;
+    std::size_t count = STORE_SCAN_COUNT;
+    std::string match;
+};
+
+// Reads the arguments of a SCAN or paged LIST, `[cursor] [pattern] [count]`, where the count is
+// only taken with --count and the pattern only by SCAN. A cursor of 0 starts from the first key.
+// Returns false if they don't fit.
+static bool readPageArgs(const Command &cmd, bool takesPattern, PageArgs &page) {
+    const std::vector<ValueSP> &args = cmd.getArgs();
+    std::size_t n = args.size(), i = 0;
+    for (const ValueSP &arg : args)
+        if (!arg) return false;
+
+    if (cmd.hasOption(CommandOption::COUNT)) {
+        if (!n || args[n - 1]->getNodeType() != NodeType::INT) return false;
+        int count = args[--n]->evaluate().getInt();
+        if (count < 1) return false;
+        page.count = count;
+    }
+
+    if (i < n) {
+        if (args[i]->getNodeType() == NodeType::INT) {
+            if (args[i]->evaluate().getInt() != 0) return false;
+        } else if (args[i]->isIdentifier() || args[i]->getNodeType() == NodeType::STRING) {
+            page.cursor = searchArg(args[i]);
         } else {
-            e.printToConsole(NOT_FOUND_MSG);
+            return false;
         }
+        i++;
     }
+
+    if (takesPattern && i < n) {
+        if (!args[i]->isIdentifier() && args[i]->getNodeType() != NodeType::STRING) return false;
+        page.match = searchArg(args[i++]);
+    }
+    return i == n;
+}
+
+static inline std::string cursorHeader(const std::string &next, std::size_t numKeys) {
+    return T_BYLLW "Next cursor: " + (next.empty() ? std::string("0") : next) + " ("
+        + std::to_string(numKeys) + ")" T_RESET;
 }
 
+bool ListCommand::validateValues() const {
+    PageArgs page;
+    return readPageArgs(*this, false, page);
+}
+
+// Lists everything at once unless given a cursor or count, in which case it lists a page of keys
+// in order.
 void ListCommand::execute(EnvironmentInterface &e, Store &s) const {
-    if (s.size() < 1) e.printToConsole(PRINT_YELLOW("(empty)"));
-    for (const auto &item : s)
+    if (!numArgs() && !hasOption(CommandOption::COUNT)) {
+        if (s.size() < 1) e.printToConsole(PRINT_YELLOW("(empty)"));
+        s.forEach([&e](const std::string &key, const StoreValue &value) {
+            e.printToConsole(PRINT_ITEM(key, value.string()));
+        });
+        return;
+    }
 
-        e.printToConsole(PRINT_ITEM(item.first, item.second->string()));
+    PageArgs page;
+    readPageArgs(*this, false, page);
+    std::vector<std::string> keys;
+    std::string next = s.scan(page.cursor, page.count, keys);
+
+    std::vector<const std::string *> keyPtrs;
+    for (const std::string &key : keys)
+        keyPtrs.push_back(&key);
+    std::vector<StoreValue> values;
+    s.getMany(keyPtrs, values);
+
+    e.printToConsole(cursorHeader(next, keys.size()));
+    for (std::size_t i = 0; i < keys.size(); i++)
+        if (values[i]) e.printToConsole(PRINT_ITEM(keys[i], values[i].string()));
 }
 
 bool DeleteCommand::validate() const {
@@ -116,8 +324,7 @@ bool DeleteCommand::validate() const {
     for (const ValueSP &arg : args_) {
         if (!arg) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(arg->evaluate());
-        if (!idNode) return false;
+        if (!arg->isIdentifier()) return false;
     }
     return true;
 }
@@ -126,8 +333,7 @@ void DeleteCommand::execute(EnvironmentInterface &e, Store &s) const {
     for (const ValueSP &arg : args_) {
         if (!arg) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(arg->evaluate());
-        const std::string &ident = idNode->getValue();
+        const std::string &ident = arg->identifier();
 
         bool deleted = s.del(ident);
         if (deleted) {
@@ -136,6 +342,7 @@ void DeleteCommand::execute(EnvironmentInterface &e, Store &s) const {
             e.printToConsole(NOT_FOUND_MSG);
         }
     }
+    e.logCommand(*this, numArgs());
 }
 
 bool UpdateCommand::validate() const {
@@ -144,22 +351,23 @@ bool UpdateCommand::validate() const {
     for (std::size_t i = 0; i < numArgs(); i += 2) {
         if (!args_[i]) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(args_[i]->evaluate());
-        if (!idNode) return false;
+        if (!args_[i]->isIdentifier()) return false;
 
         if (!(i + 1 < numArgs()) || !args_[i + 1]) return false;
     }
     return true;
 }
 
+// Logged up front, as the values are then moved into the store
 void UpdateCommand::execute(EnvironmentInterface &e, Store &s) const {
+    e.logCommand(*this, numArgs());
+
     for (std::size_t i = 0; i < numArgs(); i += 2) {
         if (!args_[i]) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(args_[i]->evaluate());
-        const std::string &ident = idNode->getValue();
+        const std::string &ident = args_[i]->identifier();
 
-        bool updated = s.update(ident, (args_[i + 1])->evaluate());
+        bool updated = s.update(ident, args_[i + 1]->take());
         if (updated) {
             e.printToConsole(OK_MSG);
         } else {
@@ -174,8 +382,7 @@ bool ResolveCommand::validate() const {
     for (const ValueSP &arg : args_) {
         if (!arg) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(arg->evaluate());
-        if (!idNode) return false;
+        if (!arg->isIdentifier()) return false;
     }
     return true;
 }
@@ -184,13 +391,11 @@ void ResolveCommand::execute(EnvironmentInterface &e, Store &s) const {
     for (const ValueSP &arg : args_) {
         if (!arg) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(arg->evaluate());
-        const std::string &ident = idNode->getValue();
+        const std::string &ident = arg->identifier();
 
-        StoreValueSP value = s.resolve(ident, true);
+        StoreValue value = s.resolve(ident, true);
         if (value) {
-
-            e.printToConsole(PRINT_ITEM(ident, value->string()));
+            e.printToConsole(PRINT_ITEM(ident, value.string()));
         } else {
             e.printToConsole(NOT_FOUND_MSG);
         }
@@ -201,26 +406,44 @@ void SaveCommand::execute(EnvironmentInterface &e, Store &s) const {
     std::string &filename = DEFAULT_SAVE_FILE;
     if (numArgs()) filename = getFilename_(args_[0]);
 
+    if (hasOption(CommandOption::BG)) {
+        s.saveToFileInBackground(filename + ".kep");
+        e.printToConsole(PRINT_GREEN("SAVING IN BACKGROUND"));
+        return;
+    }
+
     s.saveToFile(filename + ".kep");
     e.printToConsole(PRINT_GREEN("SAVED"));
 }
 
+// The items loaded are logged rather than the file's name, so that replaying the log doesn't depend
+// on the file, which may have changed or gone since.
 void LoadCommand::execute(EnvironmentInterface &e, Store &s) const {
     std::string &filename = DEFAULT_SAVE_FILE;
     if (numArgs()) filename = getFilename_(args_[0]);
 
-    s.loadFromFile(filename + ".kep");
+    Store::LoadVisitor log;
+    if (e.isLogging()) {
+        log = [&e](const std::string &key, const StoreValue &value, int64_t expiresAt) {
+            logLoaded(e, key, value, expiresAt);
+        };
+    }
+    s.loadFromFile(filename + ".kep", log);
     e.printToConsole(PRINT_GREEN("LOADED"));
 }
 
+void CompactCommand::execute(EnvironmentInterface &e, Store &s) const {
+    e.compactLog(s);
+    e.printToConsole(PRINT_GREEN("COMPACTING IN BACKGROUND"));
+}
+
 bool RenameCommand::validate() const {
     if (numArgs() < 2) return false;
 
     for (std::size_t i = 0; i < numArgs(); i += 2) {
         if (!args_[i]) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(args_[i]->evaluate());
-        if (!idNode) return false;
+        if (!args_[i]->isIdentifier()) return false;
 
         if (!(i + 1 < numArgs()) || !args_[i + 1]) return false;
     }
@@ -231,13 +454,10 @@ void RenameCommand::execute(EnvironmentInterface &e, Store &s) const {
     for (std::size_t i = 0; i < numArgs(); i += 2) {
         if (!args_[i]) continue;
 
-        IdentifierValueSP oldNode
-            = std::dynamic_pointer_cast<IdentifierValue>((args_[i])->evaluate());
-        IdentifierValueSP newNode
-            = std::dynamic_pointer_cast<IdentifierValue>((args_[i + 1])->evaluate());
-
-        const std::string &oldName = oldNode->getValue();
-        const std::string &newName = newNode->getValue();
+        const std::string &oldName = args_[i]->identifier();
+        const std::string newName = args_[i + 1]->isIdentifier()
+            ? args_[i + 1]->identifier()
+            : args_[i + 1]->evaluate().getString();
 
         // Make the user confirm overwrites
         if (s.contains(newName) && !hasOption(CommandOption::YES)) {
@@ -247,20 +467,21 @@ void RenameCommand::execute(EnvironmentInterface &e, Store &s) const {
 
             if (hasOption(CommandOption::NO)) {
                 e.printToConsole(PRINT_YELLOW("No changes made to the store."));
+                logPartial(e, *this, i);
                 return;
             }
 
-            std::string confirm;
-            std::getline(std::cin, confirm);
-            if (confirm.size() && confirm[0] != 'y') {
+            if (!e.confirm()) {
                 e.printToConsole(PRINT_YELLOW("No changes made to the store."));
+                logPartial(e, *this, i);
                 return;
             }
         }
 
-        s.rename(oldName, newName);
+        s.rename(oldName, newName, hasOption(CommandOption::CASCADE));
         e.printToConsole(OK_MSG);
     }
+    e.logCommand(*this, numArgs());
 }
 
 bool IncrementCommand::validate() const {
@@ -269,8 +490,7 @@ bool IncrementCommand::validate() const {
     for (const ValueSP &arg : args_) {
         if (!arg) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(arg->evaluate());
-        if (!idNode) return false;
+        if (!arg->isIdentifier()) return false;
     }
     return true;
 }
@@ -279,24 +499,15 @@ void IncrementCommand::execute(EnvironmentInterface &e, Store &s) const {
     for (const ValueSP &arg : args_) {
         if (!arg) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(arg->evaluate());
-        const std::string &ident = idNode->getValue();
-
-        StoreValueSP value = s.resolve(ident);
-        if (value == nullptr) {
-            e.printToConsole(NOT_FOUND_MSG);
-            continue;
-        }
+        const std::string &ident = arg->identifier();
 
-        NumericTypeSP number = std::dynamic_pointer_cast<NumericType>(value);
-        if (!number) {
-            e.printToConsole(PRINT_RED(NOT_NUMERIC));
-            continue;
+        switch (s.incr(ident)) {
+            case StoreResult::NOT_FOUND: e.printToConsole(NOT_FOUND_MSG); break;
+            case StoreResult::WRONG_TYPE: e.printToConsole(PRINT_RED(NOT_NUMERIC)); break;
+            default: e.printToConsole(OK_MSG); break;
         }
-
-        number->incr();
-        e.printToConsole(OK_MSG);
     }
+    e.logCommand(*this, numArgs());
 }
 
 bool DecrementCommand::validate() const {
@@ -305,8 +516,7 @@ bool DecrementCommand::validate() const {
     for (const ValueSP &arg : args_) {
         if (!arg) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(arg->evaluate());
-        if (!idNode) return false;
+        if (!arg->isIdentifier()) return false;
     }
     return true;
 }
@@ -315,110 +525,354 @@ void DecrementCommand::execute(EnvironmentInterface &e, Store &s) const {
     for (const ValueSP &arg : args_) {
         if (!arg) continue;
 
-        IdentifierValueSP idNode = std::dynamic_pointer_cast<IdentifierValue>(arg->evaluate());
-        const std::string &ident = idNode->getValue();
+        const std::string &ident = arg->identifier();
 
-        StoreValueSP value = s.resolve(ident);
-        if (value == nullptr) {
-            e.printToConsole(NOT_FOUND_MSG);
-            continue;
+        switch (s.decr(ident)) {
+            case StoreResult::NOT_FOUND: e.printToConsole(NOT_FOUND_MSG); break;
+            case StoreResult::WRONG_TYPE: e.printToConsole(PRINT_RED(NOT_NUMERIC)); break;
+            default: e.printToConsole(OK_MSG); break;
         }
-
-        NumericTypeSP number = std::dynamic_pointer_cast<NumericType>(value);
-        if (!number) {
-            e.printToConsole(PRINT_RED(NOT_NUMERIC));
-            continue;
-        }
-
-        number->decr();
-        e.printToConsole(OK_MSG);
     }
+    e.logCommand(*this, numArgs());
 }
 
 bool AppendCommand::validate() const {
     if (numArgs() < 2) return false;
 
     // First must be an identifier to a list
-    IdentifierValueSP identNode = std::dynamic_pointer_cast<IdentifierValue>(args_[0]->evaluate());
-    if (!identNode) return false;
-    return true;
+    return args_[0]->isIdentifier();
 }
 
 void AppendCommand::execute(EnvironmentInterface &e, Store &s) const {
-    IdentifierValueSP identNode = std::dynamic_pointer_cast<IdentifierValue>(args_[0]->evaluate());
-    StoreValueSP listObj = s.resolve(identNode->getValue());
-    if (!listObj) {
-        e.printToConsole(NOT_FOUND_MSG);
-        return;
-    }
-
-    ListValueSP list = std::dynamic_pointer_cast<ListValue>(listObj);
-    if (!list) {
-        e.printToConsole(PRINT_YELLOW(NOT_LIST));
-        return;
-    }
+    const std::string &ident = args_[0]->identifier();
 
     for (std::size_t i = 1; i < numArgs(); i++) {
         if (!args_[i]) continue;
-        list->append((args_[i])->evaluate());
-        e.printToConsole(OK_MSG);
+
+        switch (s.append(ident, args_[i]->evaluate())) {
+            case StoreResult::NOT_FOUND:
+                e.printToConsole(NOT_FOUND_MSG);
+                logPartial(e, *this, i);
+                return;
+            case StoreResult::WRONG_TYPE:
+                e.printToConsole(PRINT_YELLOW(NOT_LIST));
+                logPartial(e, *this, i);
+                return;
+            default: e.printToConsole(OK_MSG); break;
+        }
     }
+    e.logCommand(*this, numArgs());
 }
 
 bool PrependCommand::validate() const {
     if (numArgs() < 2) return false;
 
     // First must be an identifier to a list
-    IdentifierValueSP identNode = std::dynamic_pointer_cast<IdentifierValue>(args_[0]->evaluate());
-    if (!identNode) return false;
-    return true;
+    return args_[0]->isIdentifier();
 }
 
 void PrependCommand::execute(EnvironmentInterface &e, Store &s) const {
-    IdentifierValueSP identNode = std::dynamic_pointer_cast<IdentifierValue>(args_[0]->evaluate());
-    StoreValueSP listObj = s.resolve(identNode->getValue());
-    if (!listObj) {
-        e.printToConsole(NOT_FOUND_MSG);
-        return;
+    const std::string &ident = args_[0]->identifier();
+
+    for (std::size_t i = 1; i < numArgs(); i++) {
+        if (!args_[i]) continue;
+
+        switch (s.prepend(ident, args_[i]->evaluate())) {
+            case StoreResult::NOT_FOUND:
+                e.printToConsole(NOT_FOUND_MSG);
+                logPartial(e, *this, i);
+                return;
+            case StoreResult::WRONG_TYPE:
+                e.printToConsole(PRINT_YELLOW(NOT_LIST));
+                logPartial(e, *this, i);
+                return;
+            default: e.printToConsole(OK_MSG); break;
+        }
     }
+    e.logCommand(*this, numArgs());
+}
 
-    ListValueSP list = std::dynamic_pointer_cast<ListValue>(listObj);
-    if (!list) {
-        e.printToConsole(PRINT_YELLOW(NOT_LIST));
-        return;
+bool PopFrontCommand::validate() const {
+    if (numArgs() < 1) return false;
+
+    for (const ValueSP &arg : args_) {
+        if (!arg) continue;
+
+        if (!arg->isIdentifier()) return false;
+    }
+    return true;
+}
+
+void PopFrontCommand::execute(EnvironmentInterface &e, Store &s) const {
+    for (const ValueSP &arg : args_) {
+        if (!arg) continue;
+
+        const std::string &ident = arg->identifier();
+
+        StoreValue value;
+        switch (s.popFront(ident, value)) {
+            case StoreResult::NOT_FOUND: e.printToConsole(NOT_FOUND_MSG); break;
+            case StoreResult::WRONG_TYPE: e.printToConsole(PRINT_YELLOW(NOT_LIST)); break;
+            case StoreResult::OUT_OF_RANGE: e.printToConsole(PRINT_YELLOW(EMPTY_LIST)); break;
+            default: e.printToConsole(PRINT_ITEM(ident, value.string())); break;
+        }
+    }
+    e.logCommand(*this, numArgs());
+}
+
+bool PopBackCommand::validate() const {
+    if (numArgs() < 1) return false;
+
+    for (const ValueSP &arg : args_) {
+        if (!arg) continue;
+
+        if (!arg->isIdentifier()) return false;
+    }
+    return true;
+}
+
+void PopBackCommand::execute(EnvironmentInterface &e, Store &s) const {
+    for (const ValueSP &arg : args_) {
+        if (!arg) continue;
+
+        const std::string &ident = arg->identifier();
+
+        StoreValue value;
+        switch (s.popBack(ident, value)) {
+            case StoreResult::NOT_FOUND: e.printToConsole(NOT_FOUND_MSG); break;
+            case StoreResult::WRONG_TYPE: e.printToConsole(PRINT_YELLOW(NOT_LIST)); break;
+            case StoreResult::OUT_OF_RANGE: e.printToConsole(PRINT_YELLOW(EMPTY_LIST)); break;
+            default: e.printToConsole(PRINT_ITEM(ident, value.string())); break;
+        }
     }
+    e.logCommand(*this, numArgs());
+}
+
+bool IndexCommand::validate() const {
+    if (numArgs() != 2) return false;
+
+    return args_[0] && args_[0]->isIdentifier() && args_[1]
+        && args_[1]->getNodeType() == NodeType::INT;
+}
+
+void IndexCommand::execute(EnvironmentInterface &e, Store &s) const {
+    const std::string &ident = args_[0]->identifier();
+
+    StoreValue value;
+    switch (s.index(ident, args_[1]->evaluate().getInt(), value)) {
+        case StoreResult::NOT_FOUND: e.printToConsole(NOT_FOUND_MSG); break;
+        case StoreResult::WRONG_TYPE: e.printToConsole(PRINT_YELLOW(NOT_LIST)); break;
+        case StoreResult::OUT_OF_RANGE: e.printToConsole(PRINT_YELLOW(IDX_OUT_RANGE)); break;
+        default: e.printToConsole(PRINT_ITEM(ident, value.string())); break;
+    }
+}
+
+bool RangeCommand::validate() const {
+    if (numArgs() != 3) return false;
 
     for (std::size_t i = 1; i < numArgs(); i++) {
-        if (!args_[i]) continue;
-        list->prepend((args_[i])->evaluate());
+        if (!args_[i] || args_[i]->getNodeType() != NodeType::INT) return false;
+    }
+    return args_[0] && args_[0]->isIdentifier();
+}
+
+void RangeCommand::execute(EnvironmentInterface &e, Store &s) const {
+    const std::string &ident = args_[0]->identifier();
+
+    StoreValue value;
+    switch (s.range(ident, args_[1]->evaluate().getInt(), args_[2]->evaluate().getInt(), value)) {
+        case StoreResult::NOT_FOUND: e.printToConsole(NOT_FOUND_MSG); break;
+        case StoreResult::WRONG_TYPE: e.printToConsole(PRINT_YELLOW(NOT_LIST)); break;
+        default: e.printToConsole(PRINT_ITEM(ident, value.string())); break;
+    }
+}
+
+bool TrimCommand::validate() const {
+    if (numArgs() != 3) return false;
+
+    for (std::size_t i = 1; i < numArgs(); i++) {
+        if (!args_[i] || args_[i]->getNodeType() != NodeType::INT) return false;
+    }
+    return args_[0] && args_[0]->isIdentifier();
+}
+
+void TrimCommand::execute(EnvironmentInterface &e, Store &s) const {
+    const std::string &ident = args_[0]->identifier();
+
+    switch (s.trim(ident, args_[1]->evaluate().getInt(), args_[2]->evaluate().getInt())) {
+        case StoreResult::NOT_FOUND: e.printToConsole(NOT_FOUND_MSG); return;
+        case StoreResult::WRONG_TYPE: e.printToConsole(PRINT_YELLOW(NOT_LIST)); return;
+        default: e.printToConsole(OK_MSG); break;
+    }
+    e.logCommand(*this, numArgs());
+}
+
+bool ExpireCommand::validate() const {
+    if (numArgs() != 2 && numArgs() != 3) return false;
+    return args_[0] && args_[0]->isIdentifier();
+}
+
+bool ExpireCommand::validateValues() const {
+    return durationMs(args_[1], numArgs() == 3 ? args_[2] : nullptr) > 0;
+}
+
+void ExpireCommand::execute(EnvironmentInterface &e, Store &s) const {
+    const std::string &ident = args_[0]->identifier();
+    int64_t expiresAt = Store::nowMs() + durationMs(args_[1], numArgs() == 3 ? args_[2] : nullptr);
+    if (s.expireAt(ident, expiresAt)) {
         e.printToConsole(OK_MSG);
+        logExpireAt(e, ident, expiresAt);
+    } else {
+        e.printToConsole(NOT_FOUND_MSG);
     }
 }
 
-bool SearchCommand::validate() const {
+bool TtlCommand::validate() const {
     if (numArgs() < 1) return false;
 
     for (const ValueSP &arg : args_) {
         if (!arg) continue;
 
-        IdentifierValueSP idValue = std::dynamic_pointer_cast<IdentifierValue>(arg->evaluate());
-        if (!idValue) return false;
+        if (!arg->isIdentifier()) return false;
     }
     return true;
 }
 
-void SearchCommand::execute(EnvironmentInterface &e, Store &s) const {
+void TtlCommand::execute(EnvironmentInterface &e, Store &s) const {
+    for (const ValueSP &arg : args_) {
+        if (!arg) continue;
+
+        const std::string &ident = arg->identifier();
+
+        int64_t ttl = s.ttl(ident);
+        if (ttl == -2)
+            e.printToConsole(NOT_FOUND_MSG);
+        else if (ttl == -1)
+            e.printToConsole(PRINT_ITEM(ident, "ttl: none"));
+        else
+            e.printToConsole(PRINT_ITEM(ident, "ttl: " + std::to_string(ttl) + "ms"));
+    }
+}
+
+bool PersistCommand::validate() const {
+    if (numArgs() < 1) return false;
+
+    for (const ValueSP &arg : args_) {
+        if (!arg) continue;
+
+        if (!arg->isIdentifier()) return false;
+    }
+    return true;
+}
+
+void PersistCommand::execute(EnvironmentInterface &e, Store &s) const {
     for (const ValueSP &arg : args_) {
         if (!arg) continue;
 
-        StringValueSP patternVal = std::dynamic_pointer_cast<StringValue>(arg->evaluate());
+        if (s.persist(arg->identifier()))
+            e.printToConsole(OK_MSG);
+        else
+            e.printToConsole(NOT_FOUND_MSG);
+    }
+    e.logCommand(*this, numArgs());
+}
+
+bool ExpireAtCommand::validate() const {
+    return numArgs() == 2 && args_[0] && args_[0]->isIdentifier() && args_[1]
+        && args_[1]->getNodeType() == NodeType::STRING;
+}
+
+void ExpireAtCommand::execute(EnvironmentInterface &e, Store &s) const {
+    int64_t expiresAt;
+    try {
+        expiresAt = std::stoll(args_[1]->evaluate().getString());
+    } catch (Exception &) {
+        throw RuntimeErr(NOT_VALID_LOG);
+    }
+
+    if (s.expireAt(args_[0]->identifier(), expiresAt))
+        e.printToConsole(OK_MSG);
+    else
+        e.printToConsole(NOT_FOUND_MSG);
+}
+
+bool ScanCommand::validate() const {
+    return numArgs() > (hasOption(CommandOption::COUNT) ? 1u : 0u);
+}
+
+bool ScanCommand::validateValues() const {
+    PageArgs page;
+    return readPageArgs(*this, true, page);
+}
+
+void ScanCommand::execute(EnvironmentInterface &e, Store &s) const {
+    PageArgs page;
+    readPageArgs(*this, true, page);
+    std::vector<std::string> keys;
+    std::string next = s.scan(page.cursor, page.count, keys, page.match);
+
+    e.printToConsole(cursorHeader(next, keys.size()));
+    for (const auto &key : keys)
+        e.printToConsole(" " + key);
+}
+
+bool RefsCommand::validate() const {
+    if (numArgs() < 1) return false;
+
+    for (const ValueSP &arg : args_) {
+        if (!arg) continue;
+
+        if (!arg->isIdentifier()) return false;
+    }
+    return true;
+}
+
+void RefsCommand::execute(EnvironmentInterface &e, Store &s) const {
+    for (const ValueSP &arg : args_) {
+        if (!arg) continue;
 
-        const std::string &pattern = patternVal->getValueType() == ValueType::IDENTIFIER
-                                         ? patternVal->getValue()
-                                         : removeQuotations(patternVal->getValue());
-        std::vector<std::string> keys = s.search(pattern);
+        const std::string &ident = arg->identifier();
+        std::vector<std::string> keys = s.referrers(ident);
+        e.printToConsole(T_BYLLW + ident + " (" + std::to_string(keys.size()) + ")" T_RESET);
+
+        for (const auto &key : keys)
+            e.printToConsole(" " + key);
+    }
+}
 
-        e.printToConsole(T_BYLLW + pattern + " (" + std::to_string(keys.size()) + ")" T_RESET);
+bool SearchCommand::validate() const {
+    if (numArgs() < 1) return false;
+    int modes = hasOption(CommandOption::PREFIX) + hasOption(CommandOption::RANGE)
+        + hasOption(CommandOption::GLOB);
+    if (modes > 1) return false;
+    if (hasOption(CommandOption::RANGE) && numArgs() % 2 != 0) return false;
+
+    for (const ValueSP &arg : args_) {
+        if (!arg) return false;
+
+        if (!arg->isIdentifier() && arg->getNodeType() != NodeType::STRING) return false;
+    }
+    return true;
+}
+
+void SearchCommand::execute(EnvironmentInterface &e, Store &s) const {
+    bool range = hasOption(CommandOption::RANGE);
+    for (std::size_t i = 0; i < numArgs(); i += range ? 2 : 1) {
+        std::string header = searchArg(args_[i]);
+        std::vector<std::string> keys;
+        if (range) {
+            std::string to = searchArg(args_[i + 1]);
+            keys = s.searchRange(header, to);
+            header += ".." + to;
+        } else if (hasOption(CommandOption::PREFIX)) {
+            keys = s.searchPrefix(header);
+        } else if (hasOption(CommandOption::GLOB)) {
+            keys = s.search(header, PatternSyntax::GLOB);
+        } else {
+            keys = s.search(header);
+        }
+
+        e.printToConsole(T_BYLLW + header + " (" + std::to_string(keys.size()) + ")" T_RESET);
 
         for (const auto &key : keys)
             e.printToConsole(" " + key);
@@ -429,15 +883,12 @@ void StatsCommand::execute(EnvironmentInterface &e, Store &s) const {
     e.printToConsole(PRINT_YELLOW("KeplerKV Statistics"));
 
     int totalNum = s.size(), numInts = 0, numFloats = 0, numStrs = 0, numLists = 0, numAliases = 0;
-    std::size_t totalMem = 0, memInts = 0, memFloats = 0, memStrs = 0, memLists = 0, memAliases = 0,
-                memCurr;
-    for (const auto &pair : s) {
-        totalMem += sizeof(pair.first);
-        memCurr = pair.second ? pair.second->size() : 0;
-        if (!memCurr) continue;
-        totalMem += memCurr;
-
-        switch (pair.second->getValueType()) {
+    std::size_t memInts = 0, memFloats = 0, memStrs = 0, memLists = 0, memAliases = 0, memCurr;
+    s.forEach([&](const std::string &key, const StoreValue &value) {
+        if (!value) return;
+        memCurr = Store::itemMemory(key, value);
+
+        switch (value.getValueType()) {
             case ValueType::INT:
                 numInts++;
                 memInts += memCurr;
@@ -460,9 +911,10 @@ void StatsCommand::execute(EnvironmentInterface &e, Store &s) const {
                 break;
             default: break;
         }
-    }
+    });
 
     e.printToConsole(PRINT_YELLOW("Total keys: ") + std::to_string(totalNum));
+    e.printToConsole(PRINT_YELLOW("Keys with a TTL: ") + std::to_string(s.expiringSize()));
 
     e.printToConsole(PRINT_YELLOW("Key Distribution by Type: "));
 
@@ -472,10 +924,41 @@ void StatsCommand::execute(EnvironmentInterface &e, Store &s) const {
     e.printToConsole("\tLists: " + std::to_string(numLists));
     e.printToConsole("\tAliases: " + std::to_string(numAliases));
 
-    e.printToConsole(PRINT_YELLOW("Usage (including keys) in bytes: ") + std::to_string(totalMem));
+    // The total is kept by the store as items change, and includes keys that expired unread
+    e.printToConsole(
+        PRINT_YELLOW("Usage (including keys) in bytes: ") + std::to_string(s.usedMemory()));
     e.printToConsole("\tIntegers: " + std::to_string(memInts));
     e.printToConsole("\tFloats: " + std::to_string(memFloats));
     e.printToConsole("\tStrings: " + std::to_string(memStrs));
     e.printToConsole("\tLists: " + std::to_string(memLists));
     e.printToConsole("\tAliases: " + std::to_string(memAliases));
+
+    if (s.maxMemory()) {
+        e.printToConsole(PRINT_YELLOW("Memory limit in bytes: ") + std::to_string(s.maxMemory())
+            + " (" + evictionPolicyName(s.evictionPolicy()) + ")");
+        e.printToConsole("\tEvicted keys: " + std::to_string(s.evictedKeys()));
+    }
+
+    if (PlanCache *plans = e.getPlanCache()) {
+        const PlanCacheStats &pc = plans->stats();
+        std::size_t lookups = pc.hits + pc.misses;
+        e.printToConsole(PRINT_YELLOW("Plan cache: ") + std::to_string(plans->size()) + " plans");
+        e.printToConsole("\tHits: " + std::to_string(pc.hits));
+        e.printToConsole("\tMisses: " + std::to_string(pc.misses));
+        std::size_t hitRate = lookups ? pc.hits * 100 / lookups : 0;
+        e.printToConsole("\tHit rate (%): " + std::to_string(hitRate));
+        e.printToConsole("\tEvictions: " + std::to_string(pc.evictions));
+    }
+
+    const BackgroundSaveInfo &bg = s.backgroundSaveInfo();
+    if (bg.state == BackgroundSaveInfo::State::NONE) return;
+
+    std::string bgState = bg.state == BackgroundSaveInfo::State::RUNNING ? "in progress"
+        : bg.state == BackgroundSaveInfo::State::DONE                    ? "done"
+                                                                         : "failed";
+    e.printToConsole(PRINT_YELLOW("Background save: ") + bgState + " (" + bg.filename + ")");
+    if (bg.state == BackgroundSaveInfo::State::DONE) {
+        e.printToConsole("\tDuration (ms): " + std::to_string(bg.durationMs));
+        e.printToConsole("\tBytes written: " + std::to_string(bg.bytes));
+    }
 }
@@ -0,0 +1,363 @@
+#include "command_log.h"
+
+#include "byte_reader.h"
+#include "command_ast_nodes.h"
+#include "crc32c.h"
+#include "environment_interface.h"
+#include "error_msgs.h"
+#include "mapped_file.h"
+#include "snapshot_format.h"
+#include "store.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#define fdatasync fsync
+#endif
+
+// Up to and including the version, the part shared by every version
+static const std::size_t LOG_HEADER_SIZE = COMMAND_LOG_MAGIC.size() + sizeof(uint32_t);
+static constexpr std::size_t LOG_RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+static std::vector<uint8_t> encodeLogHeader(uint64_t snapshotSize) {
+    std::vector<uint8_t> header(COMMAND_LOG_MAGIC.begin(), COMMAND_LOG_MAGIC.end());
+    appendRaw(header, COMMAND_LOG_VERSION);
+    appendRaw(header, snapshotSize);
+    return header;
+}
+
+// Writes the whole buffer, retrying short and interrupted writes.
+static bool writeAll(int fd, const uint8_t *data, std::size_t size) {
+    while (size) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Makes a rename within the directory durable, not only the renamed file's contents.
+static void syncParentDir(const std::string &filename) {
+    std::size_t slash = filename.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    fsync(fd);
+    ::close(fd);
+}
+
+CommandLog::CommandLog()
+    : fd_(-1)
+    , policy_(FsyncPolicy::INTERVAL)
+    , size_(0)
+    , rewritePid_(-1)
+    , baseSize_(0)
+    , rewritePct_(COMMAND_LOG_REWRITE_PCT)
+    , dirty_(false)
+    , syncing_(false)
+    , stopping_(false) { }
+
+CommandLog::~CommandLog() { close(); }
+
+void CommandLog::open(const std::string &filename, FsyncPolicy policy, unsigned int intervalMs) {
+    close();
+
+    fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) throw RuntimeErr(FAIL_OPEN_WRITE);
+    filename_ = filename;
+    policy_ = policy;
+
+    struct stat st;
+    size_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+    if (size_ == 0) {
+        std::vector<uint8_t> header = encodeLogHeader(0);
+        if (!writeAll(fd_, header.data(), header.size()) || fdatasync(fd_) != 0) {
+            close();
+            throw RuntimeErr(FAIL_LOG_WRITE);
+        }
+        size_ = header.size();
+    }
+    baseSize_ = size_;
+
+    if (policy_ == FsyncPolicy::INTERVAL) {
+        stopping_ = false;
+        syncThread_ = std::thread(&CommandLog::syncLoop_, this, intervalMs);
+    }
+}
+
+// Flushes whatever is still buffered and lets a running rewrite finish, then stops the sync thread
+// with one last sync.
+void CommandLog::close() {
+    if (fd_ < 0) return;
+
+    commit();
+    finishRewrite_(true);
+    if (syncThread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(syncMtx_);
+            stopping_ = true;
+        }
+        syncCv_.notify_one();
+        syncThread_.join();
+    }
+    if (policy_ != FsyncPolicy::OS) fdatasync(fd_);
+
+    ::close(fd_);
+    fd_ = -1;
+}
+
+void CommandLog::append(const Command &cmd, std::size_t numArgs) {
+    if (fd_ < 0) return;
+
+    // The size and checksum are filled in once the payload is known
+    std::size_t start = buf_.size();
+    buf_.resize(start + LOG_RECORD_HEADER_SIZE);
+
+    buf_.push_back((uint8_t) cmd.getCmdType());
+    buf_.push_back(cmd.getOptions());
+    appendRaw(buf_, (uint32_t) numArgs);
+
+    const std::vector<ValueSP> &args = cmd.getArgs();
+    for (std::size_t i = 0; i < numArgs; i++) {
+        if (args[i])
+            args[i]->evaluate().serializeInto(buf_);
+        else
+            buf_.push_back('n');
+    }
+
+    const uint8_t *payload = buf_.data() + start + LOG_RECORD_HEADER_SIZE;
+    uint32_t payloadSize = buf_.size() - start - LOG_RECORD_HEADER_SIZE;
+    uint32_t crc = crc32c(payload, payloadSize);
+    std::memcpy(&buf_[start], &payloadSize, sizeof(payloadSize));
+    std::memcpy(&buf_[start + sizeof(payloadSize)], &crc, sizeof(crc));
+}
+
+void CommandLog::commit() {
+    if (fd_ < 0 || buf_.empty()) return;
+
+    bool written = writeAll(fd_, buf_.data(), buf_.size());
+    size_ += buf_.size();
+    if (isRewriting()) rewriteBuf_.insert(rewriteBuf_.end(), buf_.begin(), buf_.end());
+    buf_.clear();
+    if (!written) throw RuntimeErr(FAIL_LOG_WRITE);
+
+    switch (policy_) {
+        case FsyncPolicy::ALWAYS:
+            if (fdatasync(fd_) != 0) throw RuntimeErr(FAIL_LOG_WRITE);
+            break;
+        case FsyncPolicy::INTERVAL: {
+            std::lock_guard<std::mutex> lock(syncMtx_);
+            dirty_ = true;
+            break;
+        }
+        case FsyncPolicy::OS: break;
+    }
+}
+
+// Syncs at most once per interval, and only if something was written since the last sync.
+void CommandLog::syncLoop_(unsigned int intervalMs) {
+    std::unique_lock<std::mutex> lock(syncMtx_);
+    while (!stopping_) {
+        syncCv_.wait_for(lock, std::chrono::milliseconds(intervalMs));
+        if (!dirty_) continue;
+
+        // The lock isn't held while syncing, so as not to hold up commits. A finished rewrite
+        // waits for the sync to be over before closing the descriptor it swapped out.
+        dirty_ = false;
+        syncing_ = true;
+        int fd = fd_;
+        lock.unlock();
+        fdatasync(fd);
+        lock.lock();
+        syncing_ = false;
+        syncCv_.notify_all();
+    }
+}
+
+// The child writes a log holding only a snapshot, synced to disk before it reports success.
+void CommandLog::rewrite(Store &s) {
+    if (fd_ < 0) throw RuntimeErr(NO_COMMAND_LOG);
+    if (isRewriting()) throw RuntimeErr(COMPACT_RUNNING);
+
+    commit();
+    const std::string tmpName = filename_ + ".rewrite";
+
+    pid_t pid = s.forkSnapshot();
+    if (pid == 0) {
+        try {
+            std::ofstream fp(tmpName, std::ios::out | std::ios::binary | std::ios::trunc);
+            std::vector<uint8_t> header = encodeLogHeader(0);
+            fp.write(reinterpret_cast<const char *>(header.data()), header.size());
+            s.saveToStream(fp);
+
+            // The snapshot's size is only known once it has been written
+            uint64_t snapshotSize = (uint64_t) fp.tellp() - header.size();
+            header = encodeLogHeader(snapshotSize);
+            fp.seekp(0);
+            fp.write(reinterpret_cast<const char *>(header.data()), header.size());
+            fp.close();
+            if (!fp) _exit(EXIT_FAILURE);
+
+            int fd = ::open(tmpName.c_str(), O_WRONLY);
+            bool synced = fd >= 0 && fdatasync(fd) == 0;
+            if (fd >= 0) ::close(fd);
+            _exit(synced ? EXIT_SUCCESS : EXIT_FAILURE);
+        } catch (...) {
+            _exit(EXIT_FAILURE);
+        }
+    }
+    if (pid < 0) throw RuntimeErr(FAIL_COMPACT);
+
+    rewritePid_ = pid;
+    rewriteBuf_.clear();
+}
+
+void CommandLog::checkRewrite(Store &s) {
+    finishRewrite_(false);
+    if (fd_ < 0 || isRewriting() || !rewritePct_) return;
+
+    if (size_ >= COMMAND_LOG_REWRITE_MIN_SIZE && size_ - baseSize_ >= baseSize_ / 100 * rewritePct_)
+        rewrite(s);
+}
+
+// Once the child has exited, appends the commands committed in the meantime to the new log and
+// swaps it in. A failed rewrite leaves the old log in place, which is still complete.
+void CommandLog::finishRewrite_(bool wait) {
+    if (!isRewriting()) return;
+
+    int status;
+    pid_t done = waitpid(rewritePid_, &status, wait ? 0 : WNOHANG);
+    if (done == 0) return;
+    rewritePid_ = -1;
+
+    const std::string tmpName = filename_ + ".rewrite";
+    bool ok = done > 0 && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+
+    int newFd = ok ? ::open(tmpName.c_str(), O_WRONLY | O_APPEND) : -1;
+    ok = newFd >= 0 && writeAll(newFd, rewriteBuf_.data(), rewriteBuf_.size())
+        && fdatasync(newFd) == 0 && std::rename(tmpName.c_str(), filename_.c_str()) == 0;
+    rewriteBuf_.clear();
+    rewriteBuf_.shrink_to_fit();
+
+    if (!ok) {
+        if (newFd >= 0) ::close(newFd);
+        std::remove(tmpName.c_str());
+        return;
+    }
+    syncParentDir(filename_);
+
+    int oldFd;
+    {
+        std::unique_lock<std::mutex> lock(syncMtx_);
+        syncCv_.wait(lock, [this] { return !syncing_; });
+        oldFd = fd_;
+        fd_ = newFd;
+    }
+    ::close(oldFd);
+
+    struct stat st;
+    size_ = baseSize_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+}
+
+// Rebuilds a command from a record's payload, with every argument as an evaluated literal (or an
+// identifier node, for identifiers).
+static StoreCommandSP decodeCommand(ByteReader &reader) {
+    CommandType cmdType = (CommandType) reader.read<uint8_t>();
+    uint8_t options = reader.read<uint8_t>();
+    uint32_t numArgs = reader.read<uint32_t>();
+
+    CommandSP parsed = makeCommand(cmdType);
+    if (!parsed || parsed->isSystemCommand()) throw RuntimeErr(NOT_VALID_LOG);
+    StoreCommandSP cmd = std::static_pointer_cast<StoreCommand>(parsed);
+
+    // Any prompt was already answered when the command first ran, so replays never ask
+    for (uint8_t op = 1; op; op <<= 1)
+        if (options & op) cmd->setOption((CommandOption) op);
+    cmd->setOption(CommandOption::YES);
+
+    for (uint32_t i = 0; i < numArgs; i++) {
+        StoreValue value = StoreValue::fromBytes(reader);
+        ValueSP arg;
+        if (value.getValueType() == ValueType::IDENTIFIER)
+            arg = std::make_shared<IdentifierNode>(value.getString());
+        else if (value)
+            arg = std::make_shared<LiteralNode>(std::move(value));
+        cmd->addArg(arg);
+    }
+    return cmd;
+}
+
+CommandLogReplay CommandLog::replay(
+    const std::string &filename, EnvironmentInterface &e, Store &s) {
+    CommandLogReplay result;
+    if (access(filename.c_str(), F_OK) != 0) return result;
+
+    std::size_t fileSize, validSize;
+    {
+        MappedFile file(filename);
+        fileSize = file.size();
+        ByteReader reader(file.data(), file.size());
+
+        uint32_t version = 0;
+        if (fileSize >= LOG_HEADER_SIZE) {
+            if (std::string(reader.take(COMMAND_LOG_MAGIC.size()), COMMAND_LOG_MAGIC.size())
+                != COMMAND_LOG_MAGIC)
+                throw RuntimeErr(NOT_VALID_LOG);
+            version = reader.read<uint32_t>();
+            if (version > COMMAND_LOG_VERSION) throw RuntimeErr(UNSUP_LOG_VER);
+        }
+
+        // A header cut short means nothing was ever logged after it
+        if (!version || (version >= 2 && reader.remaining() < sizeof(uint64_t))) {
+            validSize = 0;
+        } else {
+            // Rewritten logs are only ever renamed into place whole, so the snapshot is complete
+            if (version >= 2) {
+                uint64_t snapshotSize = reader.read<uint64_t>();
+                if (snapshotSize) s.loadFromBytes(reader.take(snapshotSize), snapshotSize);
+            }
+
+            // Stop at the first record that is incomplete or fails its checksum
+            validSize = reader.position() - file.data();
+            while (reader.remaining() >= LOG_RECORD_HEADER_SIZE) {
+                uint32_t payloadSize = reader.read<uint32_t>();
+                uint32_t crc = reader.read<uint32_t>();
+                if (payloadSize > reader.remaining()) break;
+
+                const char *payload = reader.take(payloadSize);
+                if (crc32c(payload, payloadSize) != crc) break;
+                validSize = reader.position() - file.data();
+
+                ByteReader record(payload, payloadSize);
+                StoreCommandSP cmd = decodeCommand(record);
+                if (!cmd->isValid()) throw RuntimeErr(NOT_VALID_LOG);
+
+                // Every logged command succeeded when it first ran, so one failing now means the
+                // store would come out different: better to stop than to carry on without it
+                try {
+                    cmd->execute(e, s);
+                } catch (const Exception &err) {
+                    throw FAILED_REPLAY(result.commands + 1, err.what());
+                }
+                result.commands++;
+            }
+        }
+    }
+
+    if (validSize < fileSize) {
+        if (truncate(filename.c_str(), validSize) != 0) throw RuntimeErr(FAIL_LOG_WRITE);
+        result.discardedBytes = fileSize - validSize;
+    }
+    return result;
+}
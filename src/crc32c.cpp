@@ -0,0 +1,44 @@
+#include "crc32c.h"
+
+#include <cstring>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+static constexpr uint32_t CRC32C_POLY = 0x82F63B78; // Reflected Castagnoli polynomial
+
+struct Crc32cTable {
+    uint32_t t[256];
+
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+            t[i] = c;
+        }
+    }
+};
+
+uint32_t crc32c(const void *data, std::size_t size, uint32_t crc) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    crc = ~crc;
+
+#ifdef __SSE4_2__
+    // The crc32 instruction computes CRC32C directly, 8 bytes at a time
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc = (uint32_t) _mm_crc32_u64(crc, word);
+    }
+    for (; size; size--, p++)
+        crc = _mm_crc32_u8(crc, *p);
+#else
+    static const Crc32cTable table;
+    for (; size; size--, p++)
+        crc = table.t[(crc ^ *p) & 0xFF] ^ (crc >> 8);
+#endif
+
+    return ~crc;
+}
@@ -1,39 +1,120 @@
 #include "handler.h"
 
+#include "command_ast_nodes.h"
 #include "error_msgs.h"
 #include "terminal_colors.h"
 
 static constexpr bool DEBUG = false;
 
+// Commands that can make the store take up more memory. While it is over its cap, room is made
+// before they run, or they are refused.
+static bool growsStore(CommandType type) {
+    switch (type) {
+        case CommandType::SET:
+        case CommandType::UPDATE:
+        case CommandType::APPEND:
+        case CommandType::PREPEND:
+        case CommandType::LOAD:
+        case CommandType::COMMIT: return true;
+        default: return false;
+    }
+}
+
 /**
  * Processes a query and hands it off to the store to execute.
- * Returns whether to keep running the program.
+ * Its output and logged changes stay buffered in the environment until the caller ends the batch.
+ * Afterwards, keys past their deadline are reclaimed if it has been long enough since last time.
+ * With a memory cap, keys are evicted as needed before each command that could grow the store.
+ *
+ * Queries of a shape seen before reuse its plan: the cached commands are rebound to the query's
+ * literals instead of being parsed again. The query is still lexed, as its shape is looked up by
+ * its tokens and the literals are rebound from them. A plan is only made of commands whose shape
+ * is valid, so only the checks on their literals' values (a --ttl unit, or a SCAN count) are run
+ * again.
  */
 void Handler::handleQuery(std::string &query) {
-    std::vector<std::shared_ptr<Token>> &tokens = lexer_.tokenize(query);
+    std::vector<Token> &tokens = lexer_.tokenize(query);
     if (DEBUG)
-        for (const TokenSP &t : tokens)
-            env_->printToConsole("\t" + t->string());
-
-    std::vector<CommandSP> &nodes = parser_.parse(tokens);
-    for (const CommandSP &cmd : nodes) {
-        if (DEBUG) env_->printToConsole("\t" + cmd->string());
-
-        // Validate the command
-        if (!cmd || !cmd->validate()) throw RuntimeErr(WRONG_CMD_FMT);
-
-        // Check what kind of command this is
-        if (SystemCommandSP sysCmd = std::dynamic_pointer_cast<SystemCommand>(cmd)) {
-            sysCmd->execute(*env_);
-        } else if (StoreCommandSP storeCmd = std::dynamic_pointer_cast<StoreCommand>(cmd)) {
-            if (!storeCmd->ignoresTransactions() && env_->inTransaction()) {
-                env_->addCommand(storeCmd);
-                env_->printToConsole(PRINT_YELLOW("LOGGED"));
-            } else {
-                storeCmd->execute(*env_, *store_);
-            }
-        }
+        for (const Token &t : tokens)
+            env_->printToConsole("\t" + t.string(query));
+
+    PlanCache *plans = env_->getPlanCache();
+    std::size_t numSlots = 0;
+    bool cacheable = plans && plans->isEnabled()
+        && PlanCache::shapeKey(query, tokens, planKey_, numSlots);
+
+    Plan *plan = cacheable ? plans->find(planKey_) : nullptr;
+    std::vector<CommandSP> *commands;
+    if (plan) {
+        parser_.bind(query, tokens, *plan);
+        commands = &plan->commands;
+    } else {
+        commands = &parser_.parse(query, tokens, cacheable);
+    }
+
+    // Commands are validated up front so a plan is only made of valid ones, but still run up to
+    // the first invalid one
+    std::vector<CommandSP> &nodes = *commands;
+    std::size_t numValid = 0;
+    if (plan) {
+        while (numValid < nodes.size() && nodes[numValid]->validateValues())
+            numValid++;
+    } else {
+        while (numValid < nodes.size() && nodes[numValid] && nodes[numValid]->isValid())
+            numValid++;
+    }
+
+    // Literals the parser skipped over would shift the slots of the rest
+    if (!plan && cacheable && numValid == nodes.size() && parser_.slots.size() == numSlots) {
+        // The parser lets go of the commands, or the plan would always look in use
+        Plan newPlan;
+        newPlan.commands.swap(nodes);
+        newPlan.slots.swap(parser_.slots);
+        commands = &plans->insert(planKey_, std::move(newPlan))->commands;
+    }
+
+    for (std::size_t i = 0; i < numValid; i++) {
+        if (DEBUG) env_->printToConsole("\t" + (*commands)[i]->string());
+        execute_((*commands)[i]);
     }
+    store_->activeExpire();
+    if (numValid < commands->size()) throw RuntimeErr(WRONG_CMD_FMT);
 
     env_->setRunning(true);
 }
+
+void Handler::execute_(const CommandSP &cmd) {
+    // Check what kind of command this is
+    if (cmd->isSystemCommand()) {
+        if (growsStore(cmd->getCmdType())) makeRoom_();
+        static_cast<const SystemCommand &>(*cmd).execute(*env_);
+        return;
+    }
+
+    StoreCommand &storeCmd = static_cast<StoreCommand &>(*cmd);
+    if (!storeCmd.ignoresTransactions() && env_->inTransaction()) {
+        StoreCommandSP queued = std::static_pointer_cast<StoreCommand>(cmd);
+        env_->addCommand(queued);
+        env_->printToConsole(PRINT_YELLOW("LOGGED"));
+    } else {
+        if (growsStore(storeCmd.getCmdType())) makeRoom_();
+        storeCmd.execute(*env_, *store_);
+    }
+}
+
+// Evicted keys are logged as deleted, so that replaying the log ends up with the same store.
+void Handler::makeRoom_() {
+    if (!store_->overMemoryLimit()) return;
+
+    std::vector<std::string> evicted;
+    bool fits = store_->evict(evicted);
+    if (!evicted.empty()) {
+        CommandSP del = makeCommand(CommandType::DELETE);
+        for (std::string &key : evicted) {
+            ValueSP arg = std::make_shared<IdentifierNode>(std::move(key));
+            del->addArg(arg);
+        }
+        env_->logCommand(*del, del->numArgs());
+    }
+    if (!fits) throw RuntimeErr(OUT_OF_MEMORY);
+}
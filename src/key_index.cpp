@@ -0,0 +1,152 @@
+#include "key_index.h"
+
+#include <iterator>
+
+KeyIndex::KeyIndex()
+    : root_(new Leaf())
+    , size_(0) { }
+
+KeyIndex::~KeyIndex() { destroy_(root_); }
+
+void KeyIndex::destroy_(Node *node) {
+    if (node->isLeaf) {
+        delete static_cast<Leaf *>(node);
+        return;
+    }
+
+    Inner *inner = static_cast<Inner *>(node);
+    for (Node *child : inner->children)
+        destroy_(child);
+    delete inner;
+}
+
+std::size_t KeyIndex::childFor_(const Inner &inner, const std::string &key) {
+    return std::upper_bound(inner.separators.begin(), inner.separators.end(), key)
+        - inner.separators.begin();
+}
+
+const KeyIndex::Leaf *KeyIndex::leafFor_(const std::string &key) const {
+    const Node *node = root_;
+    while (!node->isLeaf) {
+        const Inner *inner = static_cast<const Inner *>(node);
+        node = inner->children[childFor_(*inner, key)];
+    }
+    return static_cast<const Leaf *>(node);
+}
+
+bool KeyIndex::insert(const std::string &key) {
+    Node *split = nullptr;
+    std::string separator;
+    if (!insert_(root_, key, split, separator)) return false;
+    size_++;
+
+    // The tree only grows taller at the root
+    if (split) {
+        Inner *root = new Inner();
+        root->separators.push_back(std::move(separator));
+        root->children.push_back(root_);
+        root->children.push_back(split);
+        root_ = root;
+    }
+    return true;
+}
+
+// Inserts into a subtree. A node that overflows splits in two, handing back its new right half and
+// the first key under it for the parent to add.
+bool KeyIndex::insert_(Node *node, const std::string &key, Node *&split, std::string &separator) {
+    if (node->isLeaf) {
+        Leaf *leaf = static_cast<Leaf *>(node);
+        auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
+        if (it != leaf->keys.end() && *it == key) return false;
+        leaf->keys.insert(it, key);
+        if (leaf->keys.size() <= KEY_INDEX_NODE_CAPACITY) return true;
+
+        Leaf *right = new Leaf();
+        auto half = leaf->keys.begin() + leaf->keys.size() / 2;
+        right->keys.assign(
+            std::make_move_iterator(half), std::make_move_iterator(leaf->keys.end()));
+        leaf->keys.erase(half, leaf->keys.end());
+
+        right->prev = leaf;
+        right->next = leaf->next;
+        if (leaf->next) leaf->next->prev = right;
+        leaf->next = right;
+
+        separator = right->keys.front();
+        split = right;
+        return true;
+    }
+
+    Inner *inner = static_cast<Inner *>(node);
+    std::size_t i = childFor_(*inner, key);
+    Node *childSplit = nullptr;
+    std::string childSeparator;
+    if (!insert_(inner->children[i], key, childSplit, childSeparator)) return false;
+    if (!childSplit) return true;
+
+    inner->separators.insert(inner->separators.begin() + i, std::move(childSeparator));
+    inner->children.insert(inner->children.begin() + i + 1, childSplit);
+    if (inner->children.size() <= KEY_INDEX_NODE_CAPACITY) return true;
+
+    // The middle separator moves up, rather than staying in either half
+    Inner *right = new Inner();
+    std::size_t mid = inner->separators.size() / 2;
+    separator = std::move(inner->separators[mid]);
+    right->separators.assign(std::make_move_iterator(inner->separators.begin() + mid + 1),
+        std::make_move_iterator(inner->separators.end()));
+    right->children.assign(inner->children.begin() + mid + 1, inner->children.end());
+    inner->separators.erase(inner->separators.begin() + mid, inner->separators.end());
+    inner->children.erase(inner->children.begin() + mid + 1, inner->children.end());
+
+    split = right;
+    return true;
+}
+
+bool KeyIndex::erase(const std::string &key) {
+    bool emptied = false;
+    if (!erase_(root_, key, emptied)) return false;
+    size_--;
+
+    // An inner root left with one child gives way to it, and one left with none to an empty leaf
+    while (!root_->isLeaf) {
+        Inner *root = static_cast<Inner *>(root_);
+        if (root->children.size() > 1) break;
+        root_ = root->children.empty() ? new Leaf() : root->children.front();
+        delete root;
+    }
+    return true;
+}
+
+// Removes from a subtree, dropping children left empty. `emptied` tells the caller the node itself
+// has nothing left.
+bool KeyIndex::erase_(Node *node, const std::string &key, bool &emptied) {
+    if (node->isLeaf) {
+        Leaf *leaf = static_cast<Leaf *>(node);
+        auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
+        if (it == leaf->keys.end() || *it != key) return false;
+        leaf->keys.erase(it);
+        emptied = leaf->keys.empty();
+        return true;
+    }
+
+    Inner *inner = static_cast<Inner *>(node);
+    std::size_t i = childFor_(*inner, key);
+    Node *child = inner->children[i];
+    bool childEmptied = false;
+    if (!erase_(child, key, childEmptied)) return false;
+    if (!childEmptied) return true;
+
+    if (child->isLeaf) {
+        Leaf *leaf = static_cast<Leaf *>(child);
+        if (leaf->prev) leaf->prev->next = leaf->next;
+        if (leaf->next) leaf->next->prev = leaf->prev;
+    }
+    destroy_(child);
+
+    // The child's range goes to its left neighbour, or to the next one if it was the first
+    inner->children.erase(inner->children.begin() + i);
+    if (!inner->separators.empty())
+        inner->separators.erase(inner->separators.begin() + (i ? i - 1 : 0));
+    emptied = inner->children.empty();
+    return true;
+}
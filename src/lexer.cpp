@@ -32,33 +32,44 @@ char Lexer::peekNext_() {
     return *(it_ + 1);
 }
 
-std::vector<TokenSP> &Lexer::tokenize(std::string &query) {
+// Token spanning from `start` up to the current character.
+Token Lexer::token_(TokenType type, const char *start) const {
+    uint32_t offset = static_cast<uint32_t>(start - begin_);
+    return Token { type, offset, static_cast<uint32_t>(it_ - start) };
+}
+
+std::vector<Token> &Lexer::tokenize(const std::string &query) {
     tokens.clear();
     if (query.empty()) return tokens;
 
-    it_ = query.begin();
-    iend_ = query.end();
+    begin_ = it_ = query.data();
+    iend_ = query.data() + query.size();
 
     char c;
     while ((c = peek_()) != NULL_CHAR) {
+        const char *start = it_;
         switch (c) {
             case NULL_CHAR:
             case WHITESPACE: it_++; break;
             case COMMA:
-                tokens.push_back(std::make_shared<Token>(TokenType::DELIMITER, curr_()));
+                curr_();
+                tokens.push_back(token_(TokenType::DELIMITER, start));
                 break;
             case SEMICOLON:
-                tokens.push_back(std::make_shared<Token>(TokenType::END, curr_()));
+                curr_();
+                tokens.push_back(token_(TokenType::END, start));
                 break;
             case BACKSLASH: tokens.push_back(lexCommand_()); break;
             case UNDERSCORE: tokens.push_back(lexIdentifier_()); break;
             case SINGLE_QUOTE:
             case DOUBLE_QUOTE: tokens.push_back(lexString_()); break;
             case '[':
-                tokens.push_back(std::make_shared<Token>(TokenType::LIST_START, curr_()));
+                curr_();
+                tokens.push_back(token_(TokenType::LIST_START, start));
                 break;
             case ']':
-                tokens.push_back(std::make_shared<Token>(TokenType::LIST_END, curr_()));
+                curr_();
+                tokens.push_back(token_(TokenType::LIST_END, start));
                 break;
             default:
                 // Identifiers start with underscores or letters
@@ -80,52 +91,49 @@ std::vector<TokenSP> &Lexer::tokenize(std::string &query) {
                         curr_();
                         tokens.push_back(lexOption_());
                         break;
-                    } else if (isdigit(c) || c == PLUS || c == PERIOD) {
-                        // Signed decimals and integers
+                    } else if (isdigit(peekNext_()) || peekNext_() == PERIOD) {
+                        // Negative decimals and integers
                         tokens.push_back(lexNumber_());
                         break;
                     }
                 }
 
                 // Unknown tokens
-                tokens.push_back(std::make_shared<Token>(TokenType::UNKNOWN, curr_()));
+                curr_();
+                tokens.push_back(token_(TokenType::UNKNOWN, start));
                 break;
         }
     }
 
-    tokens.push_back(std::make_shared<Token>(TokenType::END, SEMICOLON));
+    tokens.push_back(token_(TokenType::END, it_));
     return tokens;
 }
 
-TokenSP Lexer::lexCommand_() {
-    std::string s;
+// Spans the command as written; the parser reads it uppercase and without backslashes
+Token Lexer::lexCommand_() {
+    const char *start = it_;
 
     char c;
     while ((c = peek_()) != NULL_CHAR && c != WHITESPACE && c != SEMICOLON) {
-        // Represent as uppercase internally without backslashes
-        c = curr_();
-        if (c == BACKSLASH) {
-            continue;
-        }
-        s.push_back(toupper(c));
+        curr_();
     }
 
-    return std::make_shared<Token>(TokenType::COMMAND, std::move(s));
+    return token_(TokenType::COMMAND, start);
 }
 
-TokenSP Lexer::lexIdentifier_() {
-    std::string s;
+Token Lexer::lexIdentifier_() {
+    const char *start = it_;
 
     char c;
     while ((c = peek_()) != NULL_CHAR && (isalnum(c) || c == UNDERSCORE)) {
-        s.push_back(curr_());
+        curr_();
     }
-    return std::make_shared<Token>(TokenType::IDENTIFIER, std::move(s));
+    return token_(TokenType::IDENTIFIER, start);
 }
 
 // Numbers have digits, at most one sign, and at most one decimal
-TokenSP Lexer::lexNumber_() {
-    std::string s;
+Token Lexer::lexNumber_() {
+    const char *start = it_;
 
     // Flags for symbols that can only appear once
     bool signF = false;
@@ -135,56 +143,55 @@ TokenSP Lexer::lexNumber_() {
     while ((c = peek_()) != NULL_CHAR && (isdigit(c) || c == DASH || c == PLUS || c == PERIOD)) {
         if (c == DASH || c == PLUS) {
             // Not supporting arithmetic expressions for now
-            if (signF || !s.empty())
-                return std::make_shared<Token>(TokenType::UNKNOWN, std::move(s));
+            if (signF || it_ != start)
+                return token_(TokenType::UNKNOWN, start);
             else
                 signF = true;
         }
 
         if (c == PERIOD) {
             if (decimalF)
-                return std::make_shared<Token>(TokenType::UNKNOWN, std::move(s));
+                return token_(TokenType::UNKNOWN, start);
             else
                 decimalF = true;
         }
 
-        s.push_back(curr_());
+        curr_();
     }
-    return std::make_shared<Token>(TokenType::NUMBER, std::move(s));
+    return token_(TokenType::NUMBER, start);
 }
 
 // Valid strings should be denoted with quotations around the string
-TokenSP Lexer::lexString_() {
-    std::string s;
+Token Lexer::lexString_() {
+    const char *start = it_;
 
     // Parse start quote
     char quote = curr_();
     if (!(quote == SINGLE_QUOTE || quote == DOUBLE_QUOTE)) {
-        return std::make_shared<Token>(TokenType::UNKNOWN, quote);
+        return token_(TokenType::UNKNOWN, start);
     }
-    s.push_back(quote);
 
     char c;
     while ((c = peek_()) != NULL_CHAR && c != quote) {
-        s.push_back(curr_());
+        curr_();
     }
-    if ((c = peek_()) != NULL_CHAR) s.push_back(curr_()); // End quote
+    if ((c = peek_()) != NULL_CHAR) curr_(); // End quote
 
     // End quote should match start
-    if (*(s.end() - 1) != quote) return std::make_shared<Token>(TokenType::UNKNOWN, s);
-    return std::make_shared<Token>(TokenType::STRING, std::move(s));
+    if (*(it_ - 1) != quote) return token_(TokenType::UNKNOWN, start);
+    return token_(TokenType::STRING, start);
 }
 
 // Options are applied at the command level, while total behavior is controlled at program start
-TokenSP Lexer::lexOption_() {
+Token Lexer::lexOption_() {
     // Precondition: the double dashes have been iterated over
-    std::string s;
+    const char *start = it_;
 
     char c;
     while ((c = peek_()) != NULL_CHAR && c != WHITESPACE && c != SEMICOLON) {
-        // Represent as uppercase internally
-        s.push_back(toupper(curr_()));
+        curr_();
     }
 
-    return std::make_shared<Token>(TokenType::OPTION, std::move(s));
+    // Read uppercase by the parser
+    return token_(TokenType::OPTION, start);
 }
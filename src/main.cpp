@@ -1,44 +1,119 @@
 #include "environment.h"
 #include "handler.h"
+#include "query_buffer.h"
+#include "server.h"
 #include "terminal_colors.h"
 
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdint>
 #include <fstream>
 #include <getopt.h>
 #include <stdexcept>
 #include <vector>
 
 Store store;
+CommandLog commandLog;
+PlanCache planCache;
 Environment env;
 Handler handler;
 
 void printHelp();
 void interactive();
 void fromFile(std::vector<std::string> &);
+void openCommandLog(const std::string &, const std::string &);
+void serve(const std::string &, int);
+bool parseBytes(const std::string &, std::size_t &);
+bool parseCount(const std::string &, std::size_t &, std::size_t max);
+int invalidOption(const std::string &, const std::string &);
 
 int main(int argc, const char *argv[]) {
-    store = Store();
     env = Environment(&store);
+    env.setPlanCache(&planCache);
     handler = Handler(&store, &env);
 
-    if (argc == 1) {
-        interactive();
-    } else {
-        std::vector<std::string> files;
-        for (int i = 1; i < argc; i++) {
-            std::string arg(argv[i]);
-
-            if (arg == "-h" || arg == "--help") {
-                printHelp();
-            } else if (arg == "-s" || arg == "--silent") {
-                env.setSilentMode(true);
-            } else {
-                files.push_back(arg);
+    bool helpShown = false;
+    std::string logFile, fsyncPolicy, listenPath;
+    int listenPort = -1;
+    unsigned int compactPct = COMMAND_LOG_REWRITE_PCT;
+    std::size_t maxMemory = 0;
+    EvictionPolicy policy = EvictionPolicy::NOEVICTION;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+
+        if (arg == "-h" || arg == "--help") {
+            printHelp();
+            helpShown = true;
+        } else if (arg == "-s" || arg == "--silent") {
+            env.setSilentMode(true);
+        } else if ((arg == "-c" || arg == "--capacity") && i + 1 < argc) {
+            std::size_t capacity;
+            if (!parseCount(argv[++i], capacity, SIZE_MAX)) return invalidOption(arg, argv[i]);
+            store.reserve(capacity);
+        } else if ((arg == "-l" || arg == "--log") && i + 1 < argc) {
+            logFile = argv[++i];
+        } else if (arg == "--fsync" && i + 1 < argc) {
+            fsyncPolicy = argv[++i];
+            std::size_t intervalMs;
+            if (fsyncPolicy != "always" && fsyncPolicy != "os"
+                && !parseCount(fsyncPolicy, intervalMs, UINT_MAX))
+                return invalidOption(arg, fsyncPolicy);
+        } else if (arg == "--listen" && i + 1 < argc) {
+            listenPath = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            std::size_t port;
+            if (!parseCount(argv[++i], port, UINT16_MAX)) return invalidOption(arg, argv[i]);
+            listenPort = port;
+        } else if (arg == "--compact-pct" && i + 1 < argc) {
+            std::size_t pct;
+            if (!parseCount(argv[++i], pct, UINT_MAX)) return invalidOption(arg, argv[i]);
+            compactPct = pct;
+        } else if (arg == "--plan-cache" && i + 1 < argc) {
+            std::size_t capacity;
+            if (!parseCount(argv[++i], capacity, SIZE_MAX)) return invalidOption(arg, argv[i]);
+            planCache.setCapacity(capacity);
+        } else if (arg == "--maxmemory" && i + 1 < argc) {
+            if (!parseBytes(argv[++i], maxMemory)) {
+                std::cerr << T_BRED << "Error: invalid memory limit " << argv[i] << T_RESET
+                          << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--maxmemory-policy" && i + 1 < argc) {
+            if (!parseEvictionPolicy(argv[++i], policy)) {
+                std::cerr << T_BRED << "Error: unknown eviction policy " << argv[i] << T_RESET
+                          << std::endl;
+                return EXIT_FAILURE;
             }
+        } else {
+            files.push_back(arg);
         }
+    }
 
-        fromFile(files);
+    // Before the log is replayed, so the keys it brings back have their access stats kept
+    store.setMaxMemory(maxMemory, policy);
+
+    if (!logFile.empty()) {
+        try {
+            openCommandLog(logFile, fsyncPolicy);
+        } catch (const Exception &err) {
+            std::cerr << T_BRED << err.what() << T_RESET << std::endl;
+            return EXIT_FAILURE;
+        }
+        commandLog.setRewritePercentage(compactPct);
     }
 
+    // Files run first when serving, to start from the store they leave behind
+    bool serving = !listenPath.empty() || listenPort >= 0;
+    if (!files.empty())
+        fromFile(files);
+    else if (!helpShown && !serving)
+        interactive();
+
+    if (serving) serve(listenPath, listenPort);
+
+    env.endBatch();
     return EXIT_SUCCESS;
 }
 
@@ -47,59 +122,158 @@ void printHelp() {
               << "Options:\n"
               << "  -h, --help     Show this help menu\n"
               << "  -s, --silent   Run in silent mode (no output)\n"
+              << "  -c, --capacity Number of keys to make room for up front\n"
+              << "  -l, --log      Command log to replay on startup and append changes to\n"
+              << "  --fsync        When to sync the command log: always, os, or every N ms\n"
+              << "  --compact-pct  Growth (in %) that compacts the command log, 0 to disable\n"
+              << "  --plan-cache   Number of query plans to cache, 0 to disable\n"
+              << "  --maxmemory    Memory limit for keys and values, in bytes, kb, mb or gb\n"
+              << "  --maxmemory-policy  What to evict past the limit: noeviction (default),\n"
+              << "                 allkeys-lru, allkeys-lfu, volatile-lru or volatile-lfu\n"
+              << "  --listen       Serve clients on a Unix domain socket at this path\n"
+              << "  --port         Serve clients on this TCP port (loopback only)\n"
               << "Files:\n"
               << "  List of input files to process\n"
               << "  If no files are passed in, KeplerKV will run in interactive mode" << std::endl;
 }
 
+// Brings the store up to date from the log, then keeps appending to it.
+void openCommandLog(const std::string &logFile, const std::string &fsyncPolicy) {
+    FsyncPolicy policy = FsyncPolicy::INTERVAL;
+    unsigned int intervalMs = COMMAND_LOG_FSYNC_MS;
+    if (fsyncPolicy == "always")
+        policy = FsyncPolicy::ALWAYS;
+    else if (fsyncPolicy == "os")
+        policy = FsyncPolicy::OS;
+    else if (!fsyncPolicy.empty())
+        intervalMs = std::stoul(fsyncPolicy);
+
+    Environment replayEnv(&store);
+    replayEnv.setSilentMode(true);
+    CommandLogReplay replayed = CommandLog::replay(logFile, replayEnv, store);
+    if (replayed.discardedBytes) {
+        env.flush();
+        std::cout << T_BYLLW << "Warning: discarded " << replayed.discardedBytes
+                  << " bytes of incomplete commands at the end of " << logFile << T_RESET
+                  << std::endl;
+    }
+    if (replayed.commands) {
+        env.printToConsole(T_BYLLW "Replayed " + std::to_string(replayed.commands)
+            + " commands from " + logFile + T_RESET);
+    }
+
+    commandLog.open(logFile, policy, intervalMs);
+    env.setCommandLog(&commandLog);
+}
+
+// A number of bytes, optionally followed by a kb, mb or gb multiplier (in powers of 1024).
+bool parseBytes(const std::string &s, std::size_t &bytes) {
+    std::size_t end = 0;
+    try {
+        bytes = std::stoull(s, &end);
+    } catch (std::exception &) {
+        return false;
+    }
+
+    std::string unit = s.substr(end);
+    std::transform(unit.begin(), unit.end(), unit.begin(), ::tolower);
+    if (unit == "kb")
+        bytes <<= 10;
+    else if (unit == "mb")
+        bytes <<= 20;
+    else if (unit == "gb")
+        bytes <<= 30;
+    else if (!unit.empty())
+        return false;
+    return true;
+}
+
+// A whole number no greater than `max`, with no sign, spaces or anything else after it.
+bool parseCount(const std::string &s, std::size_t &n, std::size_t max) {
+    if (s.empty() || !isdigit((unsigned char) s[0])) return false;
+
+    std::size_t end = 0;
+    try {
+        n = std::stoull(s, &end);
+    } catch (std::exception &) {
+        return false;
+    }
+    return end == s.size() && n <= max;
+}
+
+// Reports an option given a value it doesn't take, then shows the usage. Returns the exit status.
+int invalidOption(const std::string &option, const std::string &value) {
+    std::cerr << T_BRED << "Error: invalid value for " << option << ": " << value << T_RESET
+              << std::endl;
+    printHelp();
+    return EXIT_FAILURE;
+}
+
+void serve(const std::string &listenPath, int listenPort) {
+    Server server(&store, commandLog.isOpen() ? &commandLog : nullptr, &planCache);
+    if (!listenPath.empty()) {
+        server.listenUnix(listenPath);
+        env.printToConsole(PRINT_BLUE("Listening on ") + listenPath);
+    }
+    if (listenPort >= 0) {
+        server.listenTcp(listenPort);
+        env.printToConsole(PRINT_BLUE("Listening on port ") + std::to_string(listenPort));
+    }
+    env.flush();
+    server.run();
+}
+
 void interactive() {
     std::string input;
 
     env.printToConsole(PRINT_BLUE("Welcome to KeplerKV! Type \\q to quit!"));
+    env.flush();
     while (env.isRunning()) {
         std::cout << "> ";
         std::getline(std::cin, input);
 
         try {
             handler.handleQuery(input);
+            env.endBatch();
         } catch (std::exception &e) {
+            env.flush();
             std::cerr << T_BRED << e.what() << T_RESET << std::endl;
         }
     }
 }
 
+// Scripts are read in chunks and their queries run as a pipeline: output (and the changes to log)
+// build up until OUTPUT_BATCH_SIZE, rather than being flushed after every query.
 void fromFile(std::vector<std::string> &files) {
+    char buf[OUTPUT_BATCH_SIZE];
     for (std::string &filePath : files) {
-        std::fstream file(filePath, std::ios::in);
+        std::fstream file(filePath, std::ios::in | std::ios::binary);
         if (!file.is_open()) {
             throw std::runtime_error("Error: could not open file");
         }
 
         std::string fileExt = filePath.substr(filePath.size() - 3);
         if (fileExt != "kep") {
+            env.flush();
             std::cout << T_BYLLW << "Warning: " << filePath << " is not a valid .kep file, skipped"
                       << T_RESET << std::endl;
         }
 
-        // Read each statement semicolon delimited at once
-        std::string line;
+        QueryBuffer queries;
         std::string query;
-        while (std::getline(file, line)) {
-            size_t pos = line.find(';');
-            if (pos != std::string::npos) {
-                query += line.substr(0, pos);
-
+        while (file.read(buf, sizeof(buf)) || file.gcount() > 0) {
+            queries.append(buf, file.gcount());
+            while (queries.next(query)) {
                 try {
                     handler.handleQuery(query);
                 } catch (std::exception &e) {
+                    env.flush();
                     std::cerr << T_BRED << e.what() << T_RESET << std::endl;
                 }
-                query = "";
-            } else {
-                // Query may continue onto another line (or EOF)
-                query += line + " ";
+                if (env.output().size() >= OUTPUT_BATCH_SIZE) env.endBatch();
             }
         }
+        env.endBatch();
 
         file.close();
     }
@@ -0,0 +1,40 @@
+#include "mapped_file.h"
+
+#include "error_msgs.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string &filename)
+    : data_(nullptr)
+    , size_(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw RuntimeErr(FAIL_OPEN_READ);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw RuntimeErr(FAIL_OPEN_READ);
+    }
+    size_ = st.st_size;
+
+    // Empty files can't be mapped, they are left as an empty buffer
+    if (size_) {
+        void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            throw RuntimeErr(FAIL_OPEN_READ);
+        }
+        madvise(addr, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char *>(addr);
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) munmap(const_cast<char *>(data_), size_);
+}
@@ -5,34 +5,62 @@
 #include "syntax_tree.h"
 #include "token.h"
 
+#include <cctype>
+
 // Returns current character (or null char if no more) and increments.
-TokenSP Parser::curr_() {
+const Token *Parser::curr_() {
     if (tt_ == tend_) return nullptr;
-    return *tt_++;
+    return &*tt_++;
 }
 
 // Returns current character (or null if no more), does NOT increment.
-TokenSP Parser::peek_() {
+const Token *Parser::peek_() {
     if (tt_ == tend_) return nullptr;
-    return *tt_;
+    return &*tt_;
 }
 
 // Returns next character (or null if no more), does NOT increment.
-TokenSP Parser::peekNext_() {
+const Token *Parser::peekNext_() {
     if ((tt_ + 1) == tend_) return nullptr;
-    return *(tt_ + 1);
+    return &*(tt_ + 1);
+}
+
+// The text of a token, valid until the next call.
+const std::string &Parser::text_(const Token &tok) {
+    scratch_.assign(query_->data() + tok.offset, tok.len);
+    return scratch_;
 }
 
-std::vector<CommandSP> &Parser::parse(std::vector<TokenSP> &tokens) {
+// The text of a command or option as matched internally: uppercase without backslashes.
+const std::string &Parser::upper_(const Token &tok) {
+    const char *c = query_->data() + tok.offset;
+    const char *end = c + tok.len;
+
+    scratch_.clear();
+    for (; c != end; c++) {
+        if (*c != '\\') scratch_.push_back(toupper(*c));
+    }
+    return scratch_;
+}
+
+std::vector<CommandSP> &Parser::parse(
+    const std::string &query, std::vector<Token> &tokens, bool forPlan) {
     nodes.clear();
+    slots.clear();
+    arena_.reset();
     if (tokens.empty()) return nodes;
 
+    // Cached plans outlive the query, so they don't come out of the arena
+    alloc_ = forPlan ? nullptr : &arena_;
+    recordSlots_ = forPlan;
+
+    query_ = &query;
     tt_ = tokens.begin();
     tend_ = tokens.end();
 
     // First token must be a command
-    TokenSP tok = peek_();
-    if (!tok || tok->type != TokenType::COMMAND) throw INVALID_CMD(tok->value);
+    const Token *tok = peek_();
+    if (!tok || tok->type != TokenType::COMMAND) throw INVALID_CMD(text_(*tok));
 
     while ((tok = peek_())) {
         if (tok->type == TokenType::END || tok->type != TokenType::COMMAND) {
@@ -46,51 +74,47 @@ std::vector<CommandSP> &Parser::parse(std::vector<TokenSP> &tokens) {
 }
 
 CommandSP Parser::parseCommand_() {
-    TokenSP cmdTok = curr_();
-    CommandType cmdType = mapGet(mapToCmd, cmdTok->value, CommandType::UNKNOWN);
-    if (cmdType == CommandType::UNKNOWN) throw INVALID_CMD(cmdTok->value);
-
-    CommandSP cmd;
-    switch (cmdType) {
-        case CommandType::QUIT: cmd = std::make_shared<QuitCommand>(); break;
-        case CommandType::CLEAR: cmd = std::make_shared<ClearCommand>(); break;
-        case CommandType::SET: cmd = std::make_shared<SetCommand>(); break;
-        case CommandType::GET: cmd = std::make_shared<GetCommand>(); break;
-        case CommandType::LIST: cmd = std::make_shared<ListCommand>(); break;
-        case CommandType::DELETE: cmd = std::make_shared<DeleteCommand>(); break;
-        case CommandType::UPDATE: cmd = std::make_shared<UpdateCommand>(); break;
-        case CommandType::RESOLVE: cmd = std::make_shared<ResolveCommand>(); break;
-        case CommandType::SAVE: cmd = std::make_shared<SaveCommand>(); break;
-        case CommandType::LOAD: cmd = std::make_shared<LoadCommand>(); break;
-        case CommandType::RENAME: cmd = std::make_shared<RenameCommand>(); break;
-        case CommandType::INCR: cmd = std::make_shared<IncrementCommand>(); break;
-        case CommandType::DECR: cmd = std::make_shared<DecrementCommand>(); break;
-        case CommandType::APPEND: cmd = std::make_shared<AppendCommand>(); break;
-        case CommandType::PREPEND: cmd = std::make_shared<PrependCommand>(); break;
-        case CommandType::SEARCH: cmd = std::make_shared<SearchCommand>(); break;
-        case CommandType::STATS: cmd = std::make_shared<StatsCommand>(); break;
-        case CommandType::BEGIN: cmd = std::make_shared<BeginCommand>(); break;
-        case CommandType::COMMIT: cmd = std::make_shared<CommitCommand>(); break;
-        case CommandType::ROLLBACK: cmd = std::make_shared<RollbackCommand>(); break;
-        default: return nullptr; break;
-    }
+    const std::string &cmdName = upper_(*curr_());
+    CommandType cmdType = mapGet(mapToCmd, cmdName, CommandType::UNKNOWN);
+    if (cmdType == CommandType::UNKNOWN) throw INVALID_CMD(cmdName);
 
-    TokenSP tok = nullptr;
+    CommandSP cmd = makeCommand(cmdType, alloc_);
+    if (!cmd) return nullptr;
+
+    const Token *tok = nullptr;
     while ((tok = peek_()) && tok->type != TokenType::END) {
         switch (tok->type) {
             case TokenType::END:
             case TokenType::LIST_END:
             case TokenType::DELIMITER: curr_(); break;
             case TokenType::COMMAND: throw RuntimeErr(NESTED_CMD);
-            case TokenType::UNKNOWN: throw UNKNOWN_TOKEN(tok->value);
-            case TokenType::OPTION:
-                if (tok->value == "Y" || tok->value == "YES") {
+            case TokenType::UNKNOWN: throw UNKNOWN_TOKEN(text_(*tok));
+            case TokenType::OPTION: {
+                const std::string &opt = upper_(*tok);
+                if (opt == "Y" || opt == "YES") {
                     cmd->setOption(CommandOption::YES);
-                } else if (tok->value == "N" || tok->value == "NO") {
+                } else if (opt == "N" || opt == "NO") {
                     cmd->setOption(CommandOption::NO);
+                } else if (opt == "BG" || opt == "BACKGROUND") {
+                    cmd->setOption(CommandOption::BG);
+                } else if (opt == "PREFIX") {
+                    cmd->setOption(CommandOption::PREFIX);
+                } else if (opt == "RANGE") {
+                    cmd->setOption(CommandOption::RANGE);
+                } else if (opt == "GLOB") {
+                    cmd->setOption(CommandOption::GLOB);
+                } else if (opt == "COUNT") {
+                    cmd->setOption(CommandOption::COUNT);
+                } else if (opt == "CASCADE") {
+                    cmd->setOption(CommandOption::CASCADE);
+                } else if (opt == "TTL") {
+                    curr_();
+                    parseTtl_(*cmd);
+                    break;
                 }
                 curr_();
                 break;
+            }
             default:
                 ValueSP val = parseValue_();
                 if (val != nullptr) cmd->addArg(val);
@@ -100,43 +124,69 @@ CommandSP Parser::parseCommand_() {
     return cmd;
 }
 
+static float toFloat(const std::string &s) {
+    try {
+        return std::stof(s);
+    } catch (Exception &e) {
+        throw RuntimeErr(WRONG_F_FMT);
+    }
+}
+
+static int toInt(const std::string &s) {
+    try {
+        return std::stoi(s);
+    } catch (Exception &e) {
+        throw RuntimeErr(WRONG_I_FMT);
+    }
+}
+
 ValueSP Parser::parseValue_() {
-    TokenSP tok = curr_();
-    const std::string &tValue = tok->value;
+    const Token *tok = curr_();
+    const std::string &tValue = text_(*tok);
+
+    ValueSP val;
     switch (tok->type) {
         case TokenType::NUMBER:
-            if (strContains(tok->value, '.')) {
-                try {
-                    return std::make_shared<FloatNode>(std::stof(tValue));
-                } catch (Exception &e) {
-                    throw RuntimeErr(WRONG_F_FMT);
-                }
-            } else {
-                try {
-                    return std::make_shared<IntNode>(std::stoi(tValue));
-                } catch (Exception &e) {
-                    throw RuntimeErr(WRONG_I_FMT);
-                }
-            }
-        case TokenType::IDENTIFIER: return std::make_shared<IdentifierNode>(tValue);
-        case TokenType::STRING: return std::make_shared<StringNode>(tValue);
+            if (strContains(tValue, '.'))
+                val = makeShared<FloatNode>(alloc_, toFloat(tValue));
+            else
+                val = makeShared<IntNode>(alloc_, toInt(tValue));
+            break;
+        case TokenType::IDENTIFIER: val = makeShared<IdentifierNode>(alloc_, tValue); break;
+        case TokenType::STRING: val = makeShared<StringNode>(alloc_, tValue); break;
         case TokenType::LIST_START: return parseList_();
         default: throw UNKNOWN_TOKEN(tValue); break;
     }
-    return nullptr;
+
+    if (recordSlots_) slots.push_back(val);
+    return val;
+}
+
+// A duration is a number, with its unit written right after it (as in 30s) or seconds by default.
+// The unit lexes as an identifier of its own, so it is only taken if nothing separates the two.
+void Parser::parseTtl_(Command &cmd) {
+    const Token *tok = peek_();
+    if (!tok || tok->type != TokenType::NUMBER) throw RuntimeErr(INVALID_TTL);
+    ValueSP amount = parseValue_();
+
+    ValueSP unit;
+    const Token *next = peek_();
+    if (next && next->type == TokenType::IDENTIFIER && next->offset == tok->offset + tok->len)
+        unit = parseValue_();
+    cmd.setTtl(std::move(amount), std::move(unit));
 }
 
 ValueSP Parser::parseList_() {
-    std::shared_ptr<ListNode> lstNode = std::make_shared<ListNode>();
+    std::shared_ptr<ListNode> lstNode = makeShared<ListNode>(alloc_);
 
-    TokenSP tok = nullptr;
+    const Token *tok = nullptr;
     while ((tok = peek_()) && tok->type != TokenType::END && tok->type != TokenType::LIST_END) {
         switch (tok->type) {
             case TokenType::END:
             case TokenType::LIST_END:
             case TokenType::DELIMITER: curr_(); break;
             case TokenType::COMMAND: throw RuntimeErr(CMD_IN_LIST);
-            case TokenType::UNKNOWN: throw UNKNOWN_TOKEN(tok->value);
+            case TokenType::UNKNOWN: throw UNKNOWN_TOKEN(text_(*tok));
             default:
                 ValueSP val = parseValue_();
                 if (val != nullptr) lstNode->addNode(val);
@@ -145,3 +195,27 @@ ValueSP Parser::parseList_() {
     }
     return lstNode;
 }
+
+void Parser::bind(const std::string &query, const std::vector<Token> &tokens, Plan &plan) {
+    query_ = &query;
+
+    std::size_t slot = 0;
+    for (const Token &tok : tokens) {
+        switch (tok.type) {
+            case TokenType::NUMBER: {
+                const std::string &tValue = text_(tok);
+                if (strContains(tValue, '.'))
+                    static_cast<FloatNode &>(*plan.slots[slot++]).setValue(toFloat(tValue));
+                else
+                    static_cast<IntNode &>(*plan.slots[slot++]).setValue(toInt(tValue));
+                break;
+            }
+            case TokenType::STRING:
+            case TokenType::IDENTIFIER:
+                static_cast<StringNode &>(*plan.slots[slot++])
+                    .setValue(query.data() + tok.offset, tok.len);
+                break;
+            default: break;
+        }
+    }
+}
@@ -0,0 +1,622 @@
+#include "pattern.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <map>
+
+using ByteSet = std::bitset<256>;
+
+// Most NFA states a pattern is built into, before being left to std::regex.
+static constexpr std::size_t MAX_NFA_STATES = 1 << 16;
+
+// Thrown while compiling a regex the compiler doesn't handle (or that std::regex would reject), to
+// leave it to std::regex.
+struct UnsupportedPattern { };
+
+// A parsed pattern. SET nodes match a byte of a set (an index into the parser's sets), and REPEAT
+// nodes their only child from min to max times (no limit if max is negative).
+struct PatternNode {
+    enum Kind { SET, CONCAT, ALTERNATE, REPEAT };
+
+    explicit PatternNode(Kind k, std::size_t s = 0)
+        : kind(k)
+        , set(s)
+        , min(0)
+        , max(0) { }
+
+    Kind kind;
+    std::size_t set;
+    int min;
+    int max;
+    std::vector<PatternNode> children;
+};
+
+// The byte a set holds, or -1 if it holds none or several.
+static int onlyByte(const ByteSet &set) {
+    if (set.count() != 1) return -1;
+    int byte = 0;
+    while (!set.test(byte))
+        byte++;
+    return byte;
+}
+
+// Where a glob's bracket expression opened at `open` closes, or npos if it doesn't. A ']' right
+// after the opening (and negation) is a member rather than the end.
+static std::size_t globClassEnd(const std::string &glob, std::size_t open) {
+    std::size_t i = open + 1;
+    if (i < glob.size() && (glob[i] == '!' || glob[i] == '^')) i++;
+    if (i < glob.size() && glob[i] == ']') i++;
+    for (; i < glob.size() && glob[i] != ']'; i++)
+        if (glob[i] == '\\') i++;
+    return i < glob.size() ? i : std::string::npos;
+}
+
+// The same glob as an ECMAScript regex, for std::regex to match globs too big for a DFA.
+static std::string globToRegex(const std::string &glob) {
+    std::string re;
+    for (std::size_t i = 0; i < glob.size(); i++) {
+        char c = glob[i];
+        std::size_t close;
+        if (c == '*') {
+            re += "[\\s\\S]*";
+        } else if (c == '?') {
+            re += "[\\s\\S]";
+        } else if (c == '[' && (close = globClassEnd(glob, i)) != std::string::npos) {
+            re += '[';
+            if (glob[++i] == '!' || glob[i] == '^') {
+                re += '^';
+                i++;
+            }
+            for (; i < close; i++) {
+                if (glob[i] == '\\') i++;
+                if (std::strchr("\\[]^", glob[i])) re += '\\';
+                re += glob[i];
+            }
+            re += ']';
+        } else {
+            if (c == '\\' && i + 1 < glob.size()) c = glob[++i];
+            if (std::strchr(".^$|?*+()[]{}\\/-", c)) re += '\\';
+            re += c;
+        }
+    }
+    return re;
+}
+
+/**
+ * Parses regexes (the ECMAScript subset Pattern compiles) and globs into PatternNodes, collecting
+ * the byte sets they match.
+ */
+class PatternParser {
+public:
+    explicit PatternParser(const std::string &source)
+        : src_(source)
+        , pos_(0) { }
+
+    std::vector<ByteSet> sets;
+
+    PatternNode parseRegex() {
+        // Keys are matched whole, so anchors at either end change nothing
+        if (!src_.empty() && src_[0] == '^') pos_++;
+        PatternNode root = alternation_(0);
+        if (pos_ != src_.size()) throw UnsupportedPattern();
+        return root;
+    }
+
+    PatternNode parseGlob() {
+        ByteSet any;
+        any.set();
+        PatternNode seq(PatternNode::CONCAT);
+        while (pos_ < src_.size()) {
+            char c = src_[pos_++];
+            std::size_t close;
+            if (c == '*') {
+                seq.children.push_back(repeat_(PatternNode(PatternNode::SET, addSet_(any)), 0, -1));
+            } else if (c == '?') {
+                seq.children.emplace_back(PatternNode::SET, addSet_(any));
+            } else if (c == '[' && (close = globClassEnd(src_, pos_ - 1)) != std::string::npos) {
+                seq.children.emplace_back(PatternNode::SET, globClass_(close));
+            } else {
+                if (c == '\\' && pos_ < src_.size()) c = src_[pos_++];
+                seq.children.push_back(literal_(c));
+            }
+        }
+        return seq;
+    }
+
+private:
+    const std::string &src_;
+    std::size_t pos_;
+
+    std::size_t addSet_(const ByteSet &set) {
+        auto it = std::find(sets.begin(), sets.end(), set);
+        if (it != sets.end()) return it - sets.begin();
+        sets.push_back(set);
+        return sets.size() - 1;
+    }
+
+    PatternNode literal_(char c) {
+        ByteSet set;
+        set.set(static_cast<uint8_t>(c));
+        return PatternNode(PatternNode::SET, addSet_(set));
+    }
+
+    static PatternNode repeat_(PatternNode &&child, int min, int max) {
+        PatternNode node(PatternNode::REPEAT);
+        node.min = min;
+        node.max = max;
+        node.children.push_back(std::move(child));
+        return node;
+    }
+
+    PatternNode alternation_(int depth) {
+        PatternNode alt(PatternNode::ALTERNATE);
+        alt.children.push_back(concat_(depth));
+        while (pos_ < src_.size() && src_[pos_] == '|') {
+            pos_++;
+            alt.children.push_back(concat_(depth));
+        }
+        if (alt.children.size() == 1) return std::move(alt.children.front());
+        return alt;
+    }
+
+    PatternNode concat_(int depth) {
+        PatternNode seq(PatternNode::CONCAT);
+        while (pos_ < src_.size() && src_[pos_] != '|' && src_[pos_] != ')') {
+            if (src_[pos_] == '$' && pos_ + 1 == src_.size() && !depth) {
+                pos_++;
+                break;
+            }
+
+            PatternNode node = quantified_(atom_(depth));
+            // Groups that aren't repeated are spliced in, so their literals join the sequence's
+            if (node.kind == PatternNode::CONCAT) {
+                for (PatternNode &child : node.children)
+                    seq.children.push_back(std::move(child));
+            } else {
+                seq.children.push_back(std::move(node));
+            }
+        }
+        return seq;
+    }
+
+    PatternNode atom_(int depth) {
+        char c = src_[pos_++];
+        switch (c) {
+            case '(': {
+                if (!src_.compare(pos_, 2, "?:"))
+                    pos_ += 2;
+                else if (pos_ < src_.size() && src_[pos_] == '?')
+                    throw UnsupportedPattern();
+                PatternNode group = alternation_(depth + 1);
+                if (pos_ == src_.size() || src_[pos_] != ')') throw UnsupportedPattern();
+                pos_++;
+                return group;
+            }
+            case '[': return PatternNode(PatternNode::SET, regexClass_());
+            case '.': {
+                ByteSet set;
+                set.set();
+                set.reset('\n');
+                set.reset('\r');
+                return PatternNode(PatternNode::SET, addSet_(set));
+            }
+            case '\\': return PatternNode(PatternNode::SET, addSet_(escape_()));
+            case '*':
+            case '+':
+            case '?':
+            case '{':
+            case '}':
+            case ']':
+            case '^':
+            case '$': throw UnsupportedPattern();
+            default: return literal_(c);
+        }
+    }
+
+    PatternNode quantified_(PatternNode &&atom) {
+        if (pos_ == src_.size()) return std::move(atom);
+
+        int min, max;
+        switch (src_[pos_]) {
+            case '*': min = 0, max = -1; break;
+            case '+': min = 1, max = -1; break;
+            case '?': min = 0, max = 1; break;
+            case '{': {
+                pos_++;
+                min = max = count_();
+                if (pos_ < src_.size() && src_[pos_] == ',') {
+                    pos_++;
+                    max = pos_ < src_.size() && src_[pos_] == '}' ? -1 : count_();
+                }
+                if (pos_ == src_.size() || src_[pos_] != '}' || (max >= 0 && max < min))
+                    throw UnsupportedPattern();
+                break;
+            }
+            default: return std::move(atom);
+        }
+        pos_++;
+
+        // Lazy quantifiers match the same whole keys as greedy ones
+        if (pos_ < src_.size() && src_[pos_] == '?') pos_++;
+        if (pos_ < src_.size() && std::strchr("*+?{", src_[pos_])) throw UnsupportedPattern();
+        return repeat_(std::move(atom), min, max);
+    }
+
+    int count_() {
+        std::size_t begin = pos_;
+        int n = 0;
+        while (pos_ < src_.size() && isdigit(src_[pos_]) && n <= PATTERN_MAX_REPEAT)
+            n = n * 10 + (src_[pos_++] - '0');
+        if (pos_ == begin || n > PATTERN_MAX_REPEAT) throw UnsupportedPattern();
+        return n;
+    }
+
+    // Escapes after a backslash, in or out of brackets. Escaped letters and digits other than
+    // classes and control characters (back references, \b, \x, \u, ...) aren't handled.
+    ByteSet escape_() {
+        if (pos_ == src_.size()) throw UnsupportedPattern();
+        char c = src_[pos_++];
+        ByteSet set;
+        switch (c) {
+            case 'd':
+            case 'D':
+                for (int b = '0'; b <= '9'; b++)
+                    set.set(b);
+                break;
+            case 'w':
+            case 'W':
+                for (int b = 0; b < 256; b++)
+                    if (isalnum(b) || b == '_') set.set(b);
+                break;
+            case 's':
+            case 'S':
+                for (char b : std::string(" \t\n\v\f\r"))
+                    set.set(static_cast<uint8_t>(b));
+                break;
+            case 't': set.set('\t'); break;
+            case 'n': set.set('\n'); break;
+            case 'r': set.set('\r'); break;
+            case 'v': set.set('\v'); break;
+            case 'f': set.set('\f'); break;
+            default:
+                if (isalnum(static_cast<uint8_t>(c))) throw UnsupportedPattern();
+                set.set(static_cast<uint8_t>(c));
+                return set;
+        }
+        if (isupper(c)) set.flip();
+        return set;
+    }
+
+    std::size_t regexClass_() {
+        ByteSet set;
+        bool negated = pos_ < src_.size() && src_[pos_] == '^';
+        if (negated) pos_++;
+        if (pos_ < src_.size() && src_[pos_] == ']') throw UnsupportedPattern();
+
+        while (true) {
+            if (pos_ == src_.size()) throw UnsupportedPattern();
+            char c = src_[pos_++];
+            if (c == ']') break;
+            if (c == '[' && pos_ < src_.size() && std::strchr(":.=", src_[pos_]))
+                throw UnsupportedPattern();
+
+            ByteSet member;
+            if (c == '\\')
+                member = escape_();
+            else
+                member.set(static_cast<uint8_t>(c));
+
+            int lo = onlyByte(member);
+            if (lo < 0 || pos_ + 1 >= src_.size() || src_[pos_] != '-' || src_[pos_ + 1] == ']') {
+                set |= member;
+                continue;
+            }
+
+            pos_++;
+            char d = src_[pos_++];
+            int hi = static_cast<uint8_t>(d);
+            if (d == '\\') hi = onlyByte(escape_());
+            if (hi < lo) throw UnsupportedPattern();
+            for (int b = lo; b <= hi; b++)
+                set.set(b);
+        }
+
+        if (negated) set.flip();
+        return addSet_(set);
+    }
+
+    std::size_t globClass_(std::size_t close) {
+        ByteSet set;
+        bool negated = src_[pos_] == '!' || src_[pos_] == '^';
+        if (negated) pos_++;
+
+        while (pos_ < close) {
+            char c = src_[pos_++];
+            if (c == '\\') c = src_[pos_++];
+            uint8_t lo = c, hi = c;
+            if (pos_ + 1 < close && src_[pos_] == '-') {
+                pos_++;
+                char d = src_[pos_++];
+                if (d == '\\') d = src_[pos_++];
+                hi = d;
+            }
+            for (int b = lo; b <= hi; b++)
+                set.set(b);
+        }
+        pos_ = close + 1;
+
+        if (negated) set.flip();
+        return addSet_(set);
+    }
+};
+
+// Thompson NFA states: SET states consume a byte of their set and go to `out`, SPLIT states go to
+// `out` and `alt` without consuming anything, and reaching MATCH at the end of a key is a match.
+struct NfaState {
+    enum Kind { SET, SPLIT, MATCH } kind;
+    std::size_t set;
+    int out;
+    int alt;
+};
+
+// Builds the NFA of a node back to front: the returned state matches the node, then goes on to
+// `next`.
+static int buildNfa(const PatternNode &node, int next, std::vector<NfaState> &nfa) {
+    if (nfa.size() > MAX_NFA_STATES) throw UnsupportedPattern();
+
+    switch (node.kind) {
+        case PatternNode::SET:
+            nfa.push_back(NfaState { NfaState::SET, node.set, next, -1 });
+            return nfa.size() - 1;
+        case PatternNode::CONCAT:
+            for (auto it = node.children.rbegin(); it != node.children.rend(); it++)
+                next = buildNfa(*it, next, nfa);
+            return next;
+        case PatternNode::ALTERNATE: {
+            int start = buildNfa(node.children.back(), next, nfa);
+            for (std::size_t i = node.children.size() - 1; i-- > 0;) {
+                int branch = buildNfa(node.children[i], next, nfa);
+                nfa.push_back(NfaState { NfaState::SPLIT, 0, branch, start });
+                start = nfa.size() - 1;
+            }
+            return start;
+        }
+        case PatternNode::REPEAT: {
+            const PatternNode &child = node.children.front();
+            int start = next;
+            if (node.max < 0) {
+                // A loop back to a split between another round and moving on
+                nfa.push_back(NfaState { NfaState::SPLIT, 0, -1, next });
+                start = nfa.size() - 1;
+                int body = buildNfa(child, start, nfa);
+                nfa[start].out = body;
+            } else {
+                // Optional rounds nest, each one past the minimum able to move on
+                for (int i = node.min; i < node.max; i++) {
+                    int body = buildNfa(child, start, nfa);
+                    nfa.push_back(NfaState { NfaState::SPLIT, 0, body, next });
+                    start = nfa.size() - 1;
+                }
+            }
+            for (int i = 0; i < node.min; i++)
+                start = buildNfa(child, start, nfa);
+            return start;
+        }
+    }
+    return next;
+}
+
+// Adds the SET and MATCH states reachable from a state without consuming anything.
+static void addClosure(const std::vector<NfaState> &nfa, int state, std::vector<int> &subset,
+    std::vector<uint32_t> &seen, uint32_t round) {
+    std::vector<int> stack(1, state);
+    while (!stack.empty()) {
+        int s = stack.back();
+        stack.pop_back();
+        if (seen[s] == round) continue;
+        seen[s] = round;
+
+        if (nfa[s].kind == NfaState::SPLIT) {
+            stack.push_back(nfa[s].alt);
+            stack.push_back(nfa[s].out);
+        } else {
+            subset.push_back(s);
+        }
+    }
+}
+
+// Literal text in a pattern's top-level sequence: runs of single bytes, including the byte a
+// repetition of one at least once must start and end with. Gives the run it starts with, the
+// longest one, and whether the whole pattern is a single run.
+static void findLiterals(const PatternNode &root, const std::vector<ByteSet> &sets,
+    std::string &prefix, std::string &required, bool &isLiteral) {
+    isLiteral = false;
+    if (root.kind == PatternNode::ALTERNATE) return;
+
+    std::vector<const PatternNode *> seq;
+    if (root.kind == PatternNode::CONCAT)
+        for (const PatternNode &child : root.children)
+            seq.push_back(&child);
+    else
+        seq.push_back(&root);
+
+    std::string run;
+    bool leading = true;
+    for (const PatternNode *node : seq) {
+        int byte = node->kind == PatternNode::SET ? onlyByte(sets[node->set]) : -1;
+        if (byte >= 0) {
+            run.push_back(byte);
+            continue;
+        }
+
+        int repeated = -1;
+        if (node->kind == PatternNode::REPEAT && node->min > 0
+            && node->children.front().kind == PatternNode::SET)
+            repeated = onlyByte(sets[node->children.front().set]);
+        if (repeated >= 0) run.push_back(repeated);
+
+        if (leading) prefix = run;
+        leading = false;
+        if (run.size() > required.size()) required = run;
+        run.clear();
+        if (repeated >= 0) run.push_back(repeated);
+    }
+
+    if (leading) {
+        prefix = run;
+        isLiteral = true;
+    }
+    if (run.size() > required.size()) required = run;
+}
+
+Pattern::Pattern(const std::string &source, PatternSyntax syntax)
+    : isLiteral_(false)
+    , numClasses_(0)
+    , start_(0) {
+    try {
+        compile_(source, syntax);
+    } catch (const UnsupportedPattern &) {
+        prefix_.clear();
+        required_.clear();
+        isLiteral_ = false;
+        next_.clear();
+        accepting_.clear();
+        regex_.reset(new std::regex(syntax == PatternSyntax::GLOB ? globToRegex(source) : source));
+    }
+}
+
+void Pattern::compile_(const std::string &source, PatternSyntax syntax) {
+    PatternParser parser(source);
+    PatternNode root = syntax == PatternSyntax::GLOB ? parser.parseGlob() : parser.parseRegex();
+    const std::vector<ByteSet> &sets = parser.sets;
+    findLiterals(root, sets, prefix_, required_, isLiteral_);
+
+    // Bytes every set either holds or lacks together share a class, with one byte to stand for it
+    std::map<std::string, uint8_t> classes;
+    std::vector<int> representative;
+    for (int b = 0; b < 256; b++) {
+        std::string signature(sets.size(), '0');
+        for (std::size_t i = 0; i < sets.size(); i++)
+            if (sets[i].test(b)) signature[i] = '1';
+
+        auto inserted = classes.emplace(signature, representative.size());
+        if (inserted.second) representative.push_back(b);
+        byteClass_[b] = inserted.first->second;
+    }
+    numClasses_ = representative.size();
+
+    std::vector<NfaState> nfa(1, NfaState { NfaState::MATCH, 0, -1, -1 });
+    int nfaStart = buildNfa(root, 0, nfa);
+
+    // Subset construction, with the empty subset as the dead state
+    std::map<std::vector<int>, uint32_t> ids;
+    std::vector<std::vector<int>> subsets(1);
+    ids[subsets.front()] = 0;
+    std::vector<uint32_t> seen(nfa.size(), 0);
+    uint32_t round = 0;
+
+    std::vector<int> subset;
+    addClosure(nfa, nfaStart, subset, seen, ++round);
+    std::sort(subset.begin(), subset.end());
+    start_ = ids.emplace(subset, 1).first->second;
+    if (start_) subsets.push_back(subset);
+
+    for (std::size_t i = 0; i < subsets.size(); i++) {
+        next_.resize((i + 1) * numClasses_);
+        accepting_.push_back(std::binary_search(subsets[i].begin(), subsets[i].end(), 0));
+        for (std::size_t c = 0; c < numClasses_; c++) {
+            subset.clear();
+            round++;
+            for (int s : subsets[i])
+                if (nfa[s].kind == NfaState::SET && sets[nfa[s].set].test(representative[c]))
+                    addClosure(nfa, nfa[s].out, subset, seen, round);
+            std::sort(subset.begin(), subset.end());
+
+            auto inserted = ids.emplace(subset, subsets.size());
+            if (inserted.second) {
+                if (subsets.size() >= PATTERN_MAX_STATES) throw UnsupportedPattern();
+                subsets.push_back(subset);
+            }
+            next_[i * numClasses_ + c] = inserted.first->second;
+        }
+    }
+}
+
+// Finds a literal in a range of bytes, or returns nullptr.
+static inline const char *findLiteral(const char *data, std::size_t len, const std::string &lit) {
+    if (lit.size() == 1) return static_cast<const char *>(std::memchr(data, lit[0], len));
+    return static_cast<const char *>(memmem(data, len, lit.data(), lit.size()));
+}
+
+bool Pattern::run_(const char *key, std::size_t len) const {
+    uint32_t state = start_;
+    for (std::size_t i = 0; i < len && state; i++)
+        state = next_[state * numClasses_ + byteClass_[static_cast<uint8_t>(key[i])]];
+    return accepting_[state];
+}
+
+bool Pattern::matches(const char *key, std::size_t len) const {
+    if (regex_) return std::regex_match(key, key + len, *regex_);
+    if (!required_.empty() && !findLiteral(key, len, required_)) return false;
+    return run_(key, len);
+}
+
+void Pattern::matchBatch(const KeyBatch &batch, std::vector<std::size_t> &matched) const {
+    const char *data = batch.bytes().data();
+    if (regex_ || required_.empty()) {
+        for (std::size_t i = 0; i < batch.size(); i++)
+            if (matches(data + batch.start(i), batch.start(i + 1) - batch.start(i)))
+                matched.push_back(i);
+        return;
+    }
+
+    // Looks for the literal through the whole batch, only running the DFA over keys holding it
+    std::size_t end = batch.bytes().size(), pos = 0, i = 0;
+    while (const char *found = findLiteral(data + pos, end - pos, required_)) {
+        std::size_t at = found - data;
+        while (batch.start(i + 1) <= at)
+            i++;
+
+        // A hit running into the next key doesn't count
+        if (at + required_.size() > batch.start(i + 1)) {
+            pos = at + 1;
+            continue;
+        }
+        if (run_(data + batch.start(i), batch.start(i + 1) - batch.start(i))) matched.push_back(i);
+        pos = batch.start(++i);
+    }
+}
+
+std::shared_ptr<const Pattern> PatternCache::get(const std::string &source, PatternSyntax syntax) {
+    std::string key(1, static_cast<char>(syntax));
+    key += source;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = patterns_.find(key);
+        if (it != patterns_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->second;
+        }
+    }
+
+    // Compiled without holding the lock. Should another thread have compiled it too meanwhile,
+    // this copy replaces it.
+    std::shared_ptr<const Pattern> pattern = std::make_shared<const Pattern>(source, syntax);
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = patterns_.find(key);
+    if (it != patterns_.end()) {
+        it->second->second = pattern;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return pattern;
+    }
+
+    lru_.emplace_front(key, pattern);
+    patterns_[key] = lru_.begin();
+    if (patterns_.size() > capacity_) {
+        patterns_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+    return pattern;
+}
@@ -0,0 +1,78 @@
+#include "plan_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+bool Plan::inUse() const {
+    return std::any_of(commands.begin(), commands.end(),
+        [](const CommandSP &cmd) { return cmd.use_count() > 1; });
+}
+
+bool PlanCache::shapeKey(const std::string &query, const std::vector<Token> &tokens,
+    std::string &key, std::size_t &numSlots) {
+    key.clear();
+    numSlots = 0;
+    uint32_t prevEnd = UINT32_MAX;
+    for (const Token &tok : tokens) {
+        // An identifier written right after a number is its unit (as in --ttl 30s)
+        if (tok.type == TokenType::IDENTIFIER && tok.offset == prevEnd) key.push_back('+');
+        prevEnd = tok.type == TokenType::NUMBER ? tok.offset + tok.len : UINT32_MAX;
+
+        key.push_back('A' + static_cast<char>(tok.type));
+        switch (tok.type) {
+            case TokenType::UNKNOWN: return false;
+            case TokenType::NUMBER:
+                // Ints and floats parse into different nodes
+                key.push_back(
+                    std::memchr(query.data() + tok.offset, '.', tok.len) ? 'f' : 'i');
+                numSlots++;
+                break;
+            case TokenType::STRING:
+            case TokenType::IDENTIFIER: numSlots++; break;
+            default:
+                // Nothing else has null chars, which end a query
+                key.append(query.data() + tok.offset, tok.len);
+                key.push_back('\0');
+                break;
+        }
+    }
+    return numSlots <= PLAN_CACHE_MAX_SLOTS;
+}
+
+Plan *PlanCache::find(const std::string &key) {
+    auto it = plans_.find(key);
+    if (it == plans_.end() || it->second->second.inUse()) {
+        stats_.misses++;
+        return nullptr;
+    }
+
+    stats_.hits++;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return &it->second->second;
+}
+
+Plan *PlanCache::insert(const std::string &key, Plan &&plan) {
+    auto it = plans_.find(key);
+    if (it != plans_.end()) {
+        it->second->second = std::move(plan);
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return &it->second->second;
+    }
+
+    if (plans_.size() >= capacity_) evict_();
+    lru_.emplace_front(key, std::move(plan));
+    plans_[key] = lru_.begin();
+    return &lru_.front().second;
+}
+
+void PlanCache::setCapacity(std::size_t capacity) {
+    capacity_ = capacity;
+    while (plans_.size() > capacity_)
+        evict_();
+}
+
+void PlanCache::evict_() {
+    plans_.erase(lru_.back().first);
+    lru_.pop_back();
+    stats_.evictions++;
+}
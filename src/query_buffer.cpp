@@ -0,0 +1,40 @@
+#include "query_buffer.h"
+
+#include <cctype>
+
+bool QueryBuffer::next(std::string &query) {
+    for (; scanPos_ < buf_.size(); scanPos_++) {
+        char c = buf_[scanPos_];
+        if (quote_) {
+            if (c == quote_) quote_ = '\0';
+            continue;
+        }
+        if (c == '\'' || c == '"') {
+            quote_ = c;
+            continue;
+        }
+
+        // Queries may span lines, which the lexer sees as plain spaces
+        if (isspace(c)) buf_[scanPos_] = ' ';
+        if (c != ';') continue;
+
+        query.assign(buf_, start_, scanPos_ - start_);
+        start_ = scanPos_ + 1;
+        if (query.find_first_not_of(' ') != std::string::npos) {
+            scanPos_++;
+            return true;
+        }
+    }
+
+    // Only the incomplete query is kept
+    buf_.erase(0, start_);
+    scanPos_ -= start_;
+    start_ = 0;
+    return false;
+}
+
+void QueryBuffer::clear() {
+    buf_.clear();
+    start_ = scanPos_ = 0;
+    quote_ = '\0';
+}
@@ -0,0 +1,282 @@
+#include "server.h"
+
+#include "error_msgs.h"
+#include "terminal_colors.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) { stopRequested = 1; }
+
+Server::Connection::Connection(int fd, Store *s)
+    : fd(fd)
+    , env(s)
+    , handler(s, &env)
+    , events(EPOLLIN)
+    , closing(false)
+    , backlog(false)
+    , sent(0) { }
+
+Server::Server(Store *s, CommandLog *log, PlanCache *plans)
+    : store_(s)
+    , log_(log)
+    , plans_(plans)
+    , epollFd_(epoll_create1(EPOLL_CLOEXEC)) {
+    if (epollFd_ < 0) throw RuntimeErr(FAIL_SERVER);
+}
+
+Server::~Server() {
+    for (auto &conn : conns_)
+        ::close(conn.first);
+    for (int fd : listenFds_)
+        ::close(fd);
+    for (const std::string &path : unixPaths_)
+        unlink(path.c_str());
+    ::close(epollFd_);
+}
+
+void Server::listenUnix(const std::string &path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) throw RuntimeErr(FAIL_LISTEN);
+    path.copy(addr.sun_path, path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw RuntimeErr(FAIL_LISTEN);
+
+    // A socket file left behind by an earlier run would make bind() fail
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0
+        || listen(fd, SOMAXCONN) < 0) {
+        ::close(fd);
+        throw RuntimeErr(FAIL_LISTEN);
+    }
+
+    unixPaths_.push_back(path);
+    addListener_(fd);
+}
+
+// Only the loopback interface is served, the server has no authentication of its own.
+void Server::listenTcp(uint16_t port) {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw RuntimeErr(FAIL_LISTEN);
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0
+        || listen(fd, SOMAXCONN) < 0) {
+        ::close(fd);
+        throw RuntimeErr(FAIL_LISTEN);
+    }
+
+    addListener_(fd);
+}
+
+void Server::addListener_(int fd) {
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ::close(fd);
+        throw RuntimeErr(FAIL_LISTEN);
+    }
+    listenFds_.push_back(fd);
+}
+
+void Server::run() {
+    // No SA_RESTART, so a signal interrupts epoll_wait() and the loop can wind down normally
+    struct sigaction sa = {};
+    sa.sa_handler = requestStop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    epoll_event events[SERVER_MAX_EVENTS];
+    while (!stopRequested) {
+        int n = epoll_wait(epollFd_, events, SERVER_MAX_EVENTS, SERVER_IDLE_TIMEOUT_MS);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw RuntimeErr(FAIL_SERVER);
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (std::find(listenFds_.begin(), listenFds_.end(), fd) != listenFds_.end()) {
+                accept_(fd);
+                continue;
+            }
+
+            auto it = conns_.find(fd);
+            if (it == conns_.end()) continue;
+
+            Connection &conn = *it->second;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                if (!read_(conn)) continue;
+            }
+            if (events[i].events & EPOLLOUT) serve_(conn);
+        }
+        store_->activeExpire();
+    }
+}
+
+void Server::accept_(int listenFd) {
+    int fd;
+    while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            ::close(fd);
+            continue;
+        }
+
+        std::unique_ptr<Connection> conn(new Connection(fd, store_));
+        conn->env.setCommandLog(log_);
+        conn->env.setPlanCache(plans_);
+        conns_[fd] = std::move(conn);
+    }
+}
+
+// Reads what is available (up to SERVER_READ_LIMIT, the rest waits for the next wakeup), then
+// serves the queries completed by it. Returns false if the connection was closed.
+bool Server::read_(Connection &conn) {
+    char buf[SERVER_READ_SIZE];
+    std::size_t received = 0;
+    while (!conn.closing && !conn.backlog && received < SERVER_READ_LIMIT) {
+        ssize_t n = recv(conn.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            conn.queries.append(buf, n);
+            received += n;
+        } else if (n == 0) {
+            // The client is done sending, but still gets the replies to what it sent
+            conn.closing = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            close_(conn);
+            return false;
+        }
+    }
+
+    if (conn.queries.size() > SERVER_MAX_QUERY_SIZE) {
+        close_(conn);
+        return false;
+    }
+    return serve_(conn);
+}
+
+// Runs the queries received, and sends their replies. Queries held back by the output limit are run
+// as soon as enough of the output has gone out. Returns false if the connection was closed.
+bool Server::serve_(Connection &conn) {
+    do {
+        executeQueries_(conn);
+        if (!write_(conn)) return false;
+    } while (conn.backlog && conn.pendingOutput() <= SERVER_OUTPUT_LIMIT);
+    return true;
+}
+
+// Sends as much of the pending output as the socket takes, waiting for EPOLLOUT to send the rest.
+// Returns false if the connection was closed.
+bool Server::write_(Connection &conn) {
+    std::string &out = conn.env.output();
+    while (conn.sent < out.size()) {
+        ssize_t n = send(conn.fd, out.data() + conn.sent, out.size() - conn.sent, MSG_NOSIGNAL);
+        if (n >= 0) {
+            conn.sent += n;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            close_(conn);
+            return false;
+        }
+    }
+
+    // What was sent is only dropped once it is most of the buffer, rather than moving the rest
+    // forward after every partial send
+    if (conn.sent == out.size()) {
+        out.clear();
+        conn.sent = 0;
+    } else if (conn.sent > out.size() / 2) {
+        out.erase(0, conn.sent);
+        conn.sent = 0;
+    }
+
+    if (out.empty() && conn.closing && !conn.backlog) {
+        close_(conn);
+        return false;
+    }
+
+    // Once the client is done sending, a level-triggered EPOLLIN would keep firing on the EOF
+    uint32_t events = 0;
+    if (!conn.closing && !conn.backlog) events |= EPOLLIN;
+    if (!out.empty()) events |= EPOLLOUT;
+    if (events != conn.events) {
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = conn.fd;
+        epoll_ctl(epollFd_, EPOLL_CTL_MOD, conn.fd, &ev);
+        conn.events = events;
+    }
+    return true;
+}
+
+void Server::close_(Connection &conn) {
+    int fd = conn.fd;
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    conns_.erase(fd);
+}
+
+// Runs the complete queries received so far, until the output goes over SERVER_OUTPUT_LIMIT, then
+// logs their changes in one go (so they can share a single fdatasync) before any of their replies
+// go out.
+void Server::executeQueries_(Connection &conn) {
+    std::string query;
+    conn.backlog = false;
+    while (!conn.env.isClosing()) {
+        if (conn.pendingOutput() > SERVER_OUTPUT_LIMIT) {
+            conn.backlog = true;
+            break;
+        }
+        if (!conn.queries.next(query)) break;
+
+        try {
+            conn.handler.handleQuery(query);
+        } catch (std::exception &e) {
+            conn.env.printToConsole(T_BRED + std::string(e.what()) + T_RESET, true);
+        }
+    }
+
+    // Anything sent after a quit is dropped
+    if (conn.env.isClosing()) {
+        conn.closing = true;
+        conn.backlog = false;
+        conn.queries.clear();
+    }
+
+    try {
+        conn.env.commitLog();
+    } catch (std::exception &e) {
+        conn.env.printToConsole(T_BRED + std::string(e.what()) + T_RESET, true);
+    }
+}
@@ -0,0 +1,118 @@
+#include "snapshot_format.h"
+
+#include "crc32c.h"
+#include "error_msgs.h"
+#include "file_io_macros.h"
+
+#include <algorithm>
+
+SnapshotHeader::SnapshotHeader()
+    : version(SNAPSHOT_VERSION)
+    , keyCount(0)
+    , typeCounts()
+    , blockCount(0)
+    , dataOffset(0)
+    , indexOffset(0) { }
+
+std::size_t SnapshotHeader::encodedSize() {
+    return SNAPSHOT_MAGIC.size() + sizeof(uint32_t) + sizeof(uint64_t) * (SNAPSHOT_NUM_TYPES + 4)
+           + sizeof(uint32_t);
+}
+
+std::vector<uint8_t> SnapshotHeader::encode() const {
+    std::vector<uint8_t> buf(SNAPSHOT_MAGIC.begin(), SNAPSHOT_MAGIC.end());
+    appendRaw(buf, version);
+    appendRaw(buf, keyCount);
+    for (uint64_t count : typeCounts)
+        appendRaw(buf, count);
+    appendRaw(buf, blockCount);
+    appendRaw(buf, dataOffset);
+    appendRaw(buf, indexOffset);
+    appendRaw(buf, crc32c(buf.data(), buf.size()));
+    return buf;
+}
+
+SnapshotHeader SnapshotHeader::decode(ByteReader &reader) {
+    const char *start = reader.position();
+    if (reader.remaining() < SNAPSHOT_MAGIC.size()
+        || SNAPSHOT_MAGIC.compare(0, SNAPSHOT_MAGIC.size(), reader.take(SNAPSHOT_MAGIC.size()),
+            SNAPSHOT_MAGIC.size()))
+        throw RuntimeErr(NOT_VALID_SAVE);
+
+    SnapshotHeader header;
+    header.version = reader.read<uint32_t>();
+    if (header.version > SNAPSHOT_VERSION) throw RuntimeErr(UNSUP_SAVE_VER);
+
+    header.keyCount = reader.read<uint64_t>();
+    for (uint64_t &count : header.typeCounts)
+        count = reader.read<uint64_t>();
+    header.blockCount = reader.read<uint64_t>();
+    header.dataOffset = reader.read<uint64_t>();
+    header.indexOffset = reader.read<uint64_t>();
+
+    uint32_t expected = crc32c(start, reader.position() - start);
+    if (reader.read<uint32_t>() != expected) throw RuntimeErr(CORRUPT_SAVE);
+    return header;
+}
+
+void appendSnapshotRecord(
+    std::vector<uint8_t> &buf, const std::string &key, const StoreValue &val, int64_t expiresAt) {
+    appendRaw<size_t>(buf, key.size());
+    buf.insert(buf.end(), key.begin(), key.end());
+    buf.push_back(DELIMITER);
+    val.serializeInto(buf);
+
+    buf.push_back(expiresAt != 0);
+    if (expiresAt) appendRaw(buf, expiresAt);
+}
+
+void readSnapshotRecord(ByteReader &reader, std::string &key, StoreValue &val) {
+    size_t keySize = reader.read<size_t>();
+    key.assign(reader.take(keySize), keySize);
+    reader.skip(1);
+    val = StoreValue::fromBytes(reader);
+}
+
+int64_t readSnapshotExpiry(ByteReader &reader) {
+    return reader.read<uint8_t>() ? reader.read<int64_t>() : 0;
+}
+
+void skipSnapshotRecord(ByteReader &reader) {
+    reader.skip(reader.read<size_t>() + 1);
+    StoreValue::skipBytes(reader);
+}
+
+std::vector<SnapshotIndexEntry> readSnapshotIndex(
+    const char *data, std::size_t size, const SnapshotHeader &header) {
+    if (header.indexOffset > size) throw RuntimeErr(TRUNC_SAVE);
+    ByteReader reader(data + header.indexOffset, size - header.indexOffset);
+
+    const char *start = reader.position();
+    std::vector<SnapshotIndexEntry> index;
+    index.reserve(std::min<uint64_t>(header.blockCount, reader.remaining()));
+    for (uint64_t i = 0; i < header.blockCount; i++) {
+        SnapshotIndexEntry entry;
+        entry.offset = reader.read<uint64_t>();
+        entry.recordCount = reader.read<uint64_t>();
+        index.push_back(entry);
+    }
+
+    uint32_t expected = crc32c(start, reader.position() - start);
+    if (reader.read<uint32_t>() != expected) throw RuntimeErr(CORRUPT_SAVE);
+    return index;
+}
+
+ByteReader openSnapshotBlock(const char *data, std::size_t size, const SnapshotIndexEntry &entry) {
+    if (entry.offset > size) throw RuntimeErr(TRUNC_SAVE);
+    ByteReader reader(data + entry.offset, size - entry.offset);
+
+    SnapshotBlockHeader block;
+    block.payloadSize = reader.read<uint32_t>();
+    block.recordCount = reader.read<uint32_t>();
+    block.crc = reader.read<uint32_t>();
+    if (block.recordCount != entry.recordCount) throw RuntimeErr(CORRUPT_SAVE);
+
+    const char *payload = reader.take(block.payloadSize);
+    if (crc32c(payload, block.payloadSize) != block.crc) throw RuntimeErr(CORRUPT_SAVE);
+    return ByteReader(payload, block.payloadSize);
+}
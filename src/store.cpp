@@ -1,146 +1,1097 @@
 #include "store.h"
 
 #include "error_msgs.h"
-#include "file_io_macros.h"
-#include "util.h"
 
-#include <fstream>
-#include <regex>
+#include <algorithm>
+#include <chrono>
 
-Store::Store() {
-    map_ = std::unordered_map<std::string, StoreValueSP>();
-    map_.reserve(STORE_MIN_SIZE);
+static const char *const EVICTION_POLICY_NAMES[] = { "noeviction", "allkeys-lru", "allkeys-lfu",
+    "volatile-lru", "volatile-lfu" };
+
+bool parseEvictionPolicy(const std::string &name, EvictionPolicy &policy) {
+    std::size_t i = 0;
+    for (const char *candidate : EVICTION_POLICY_NAMES) {
+        if (name == candidate) {
+            policy = (EvictionPolicy) i;
+            return true;
+        }
+        i++;
+    }
+    return false;
+}
+
+const char *evictionPolicyName(EvictionPolicy policy) {
+    return EVICTION_POLICY_NAMES[(std::size_t) policy];
+}
+
+static inline bool isLfu(EvictionPolicy policy) {
+    return policy == EvictionPolicy::ALLKEYS_LFU || policy == EvictionPolicy::VOLATILE_LFU;
+}
+
+static inline bool isVolatile(EvictionPolicy policy) {
+    return policy == EvictionPolicy::VOLATILE_LRU || policy == EvictionPolicy::VOLATILE_LFU;
+}
+
+// Access stats only compare times within the process, so they follow a clock that never jumps
+static inline int64_t steadyMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// xorshift64*, for sampling and LFU counters; each thread has its own
+static inline uint64_t randomBits() {
+    thread_local uint64_t state = (uint64_t) steadyMs() * 0x9E3779B97F4A7C15ULL | 1;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+// With LFU, a slot's spare word holds the period of its last access in the top 24 bits, and the
+// counter in the low 8.
+static inline uint32_t lfuPeriod(int64_t now) {
+    return (uint32_t) (now / STORE_LFU_DECAY_MS) & 0xFFFFFF;
+}
+
+static inline uint8_t lfuDecayed(uint32_t meta, int64_t now) {
+    uint32_t idle = (lfuPeriod(now) - (meta >> 8)) & 0xFFFFFF;
+    uint8_t counter = meta & 0xFF;
+    return idle >= counter ? 0 : counter - idle;
+}
+
+static inline uint8_t lfuIncremented(uint8_t counter) {
+    if (counter == UINT8_MAX) return counter;
+    double base = counter > STORE_LFU_INITIAL ? counter - STORE_LFU_INITIAL : 0;
+    double chance = 1.0 / (base * STORE_LFU_LOG_FACTOR + 1);
+    return (double) (randomBits() >> 11) / (1ULL << 53) < chance ? counter + 1 : counter;
+}
+
+// Keys short enough for the string's own buffer take no heap, and longer ones are counted by length
+// rather than capacity, so that a key costs the same whichever copy is measured.
+static inline std::size_t keyHeap(const std::string &key) {
+    static const std::size_t inlineKey = std::string().capacity();
+    return key.size() > inlineKey ? key.size() + 1 : 0;
+}
+
+// A node of a std::unordered_map or set holding `Entry`: the entry, its next pointer and cached
+// hash, plus a bucket's worth of the table.
+template <typename Entry> static inline std::size_t hashNodeMemory() {
+    return sizeof(Entry) + 3 * sizeof(void *);
+}
+
+// What a cached alias chain takes up in aliasTargets_, its entries in aliasesThrough_ aside.
+template <typename AliasTarget>
+static std::size_t aliasTargetMemory(const std::string &alias, const AliasTarget &target) {
+    std::size_t bytes = hashNodeMemory<std::pair<const std::string, AliasTarget>>()
+        + keyHeap(alias) + keyHeap(target.key) + target.chain.capacity() * sizeof(std::string);
+    for (const std::string &key : target.chain)
+        bytes += keyHeap(key);
+    return bytes;
+}
+
+// A key's list of the cached chains through it, and one alias on such a list.
+static inline std::size_t throughListMemory(const std::string &key) {
+    return hashNodeMemory<std::pair<const std::string, std::unordered_set<std::string>>>()
+        + keyHeap(key);
+}
+
+static inline std::size_t throughAliasMemory(const std::string &alias) {
+    return hashNodeMemory<std::string>() + keyHeap(alias);
+}
+
+Store::Store(std::size_t initialCapacity)
+    : size_(0)
+    , expiring_(0)
+    , lastExpireCycle_(0)
+    , memory_(0)
+    , maxMemory_(0)
+    , policy_(EvictionPolicy::NOEVICTION)
+    , evicted_(0)
+    , evictCursor_(0)
+    , aliasEpoch_(0)
+    , aliasMemory_(0)
+    , bgSavePid_(-1)
+    , bgSavePipe_(-1) {
+    int64_t now = nowMs();
+    for (Shard &shard : shards_)
+        shard.wheel = TimerWheel(now);
+    reserve(initialCapacity);
+}
+
+// Deadlines outlive the process (in save files and the command log), so they follow the wall clock.
+int64_t Store::nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+void Store::reserve(std::size_t n) {
+    for (Shard &shard : shards_) {
+        ShardLock lock(shard.mtx);
+        shard.map.reserve(n / STORE_NUM_SHARDS);
+    }
 }
 
 // Indicates whether the store contains the key.
-bool Store::contains(const std::string &key) const { return map_.find(key) != map_.end(); }
+bool Store::contains(const std::string &key) const {
+    std::size_t hash = hashKey_(key);
+    const Shard &shard = shardFor_(hash);
+    ShardLock lock(shard.mtx);
+    return shard.map.find(key, hash) != nullptr && !isExpired_(shard, key, hash);
+}
 
 // Inserts a new key into the map, or updates the value if it exists.
-void Store::set(const std::string &key, StoreValueSP value) { map_[key] = value; }
+void Store::set(const std::string &key, StoreValue value, int64_t expiresAt) {
+    std::size_t hash = hashKey_(key);
+    Shard &shard = shardFor_(hash);
+    ShardLock lock(shard.mtx);
+    setExpiry_(shard, key, hash, expiresAt);
+    bool inserted;
+    Slot *slot = shard.map.findOrInsert(key, hash, inserted);
+    assign_(shard, *slot, std::move(value), inserted);
+    if (inserted) size_++;
+}
 
-// Returns the key's value, or nullptr if it is not present.
-StoreValueSP Store::get(const std::string &key) const {
-    return mapGet(map_, key, (StoreValueSP) nullptr);
+// Moves the key into the store if it is new.
+void Store::set(std::string &&key, StoreValue value, int64_t expiresAt) {
+    std::size_t hash = hashKey_(key);
+    Shard &shard = shardFor_(hash);
+    ShardLock lock(shard.mtx);
+    setExpiry_(shard, key, hash, expiresAt);
+    bool inserted;
+    Slot *slot = shard.map.findOrInsert(std::move(key), hash, inserted);
+    assign_(shard, *slot, std::move(value), inserted);
+    if (inserted) size_++;
+}
+
+// Returns a copy of the key's value, or nil if it is not present.
+StoreValue Store::get(const std::string &key) const {
+    std::size_t hash = hashKey_(key);
+    const Shard &shard = shardFor_(hash);
+    ShardLock lock(shard.mtx);
+    Slot *found = shard.map.findSlot(key, hash);
+    if (!found || isExpired_(shard, key, hash)) return StoreValue();
+    touch_(*found, false);
+    return found->value;
+}
+
+// Counting sort of a batch's indexes by shard, stable so that a key's operations keep their order.
+void Store::groupByShard_(
+    const std::vector<std::size_t> &hashes, std::vector<std::size_t> &order, ShardRuns &runs) {
+    runs.fill(0);
+    for (std::size_t hash : hashes)
+        runs[shardIndex_(hash) + 1]++;
+    for (std::size_t s = 0; s < STORE_NUM_SHARDS; s++)
+        runs[s + 1] += runs[s];
+
+    ShardRuns next = runs;
+    order.resize(hashes.size());
+    for (std::size_t i = 0; i < hashes.size(); i++)
+        order[next[shardIndex_(hashes[i])]++] = i;
+}
+
+void Store::getMany(
+    const std::vector<const std::string *> &keys, std::vector<StoreValue> &out) const {
+    std::vector<std::size_t> hashes(keys.size());
+    for (std::size_t i = 0; i < keys.size(); i++)
+        hashes[i] = hashKey_(*keys[i]);
+
+    std::vector<std::size_t> order;
+    ShardRuns runs;
+    groupByShard_(hashes, order, runs);
+
+    out.assign(keys.size(), StoreValue());
+    for (std::size_t s = 0; s < STORE_NUM_SHARDS; s++) {
+        if (runs[s] == runs[s + 1]) continue;
+
+        const Shard &shard = shards_[s];
+        ShardLock lock(shard.mtx);
+        for (std::size_t j = runs[s]; j < runs[s + 1]; j++)
+            shard.map.prefetch(hashes[order[j]]);
+        for (std::size_t j = runs[s]; j < runs[s + 1]; j++) {
+            std::size_t i = order[j];
+            Slot *found = shard.map.findSlot(*keys[i], hashes[i]);
+            if (!found || isExpired_(shard, *keys[i], hashes[i])) continue;
+            touch_(*found, false);
+            out[i] = found->value;
+        }
+    }
+}
+
+void Store::setMany(
+    std::vector<std::string> &keys, std::vector<StoreValue> &values, int64_t expiresAt) {
+    std::vector<std::size_t> hashes(keys.size());
+    for (std::size_t i = 0; i < keys.size(); i++)
+        hashes[i] = hashKey_(keys[i]);
+
+    std::vector<std::size_t> order;
+    ShardRuns runs;
+    groupByShard_(hashes, order, runs);
+
+    for (std::size_t s = 0; s < STORE_NUM_SHARDS; s++) {
+        if (runs[s] == runs[s + 1]) continue;
+
+        Shard &shard = shards_[s];
+        ShardLock lock(shard.mtx);
+        for (std::size_t j = runs[s]; j < runs[s + 1]; j++)
+            shard.map.prefetch(hashes[order[j]]);
+        for (std::size_t j = runs[s]; j < runs[s + 1]; j++) {
+            std::size_t i = order[j];
+            setExpiry_(shard, keys[i], hashes[i], expiresAt);
+            bool inserted;
+            Slot *slot = shard.map.findOrInsert(std::move(keys[i]), hashes[i], inserted);
+            assign_(shard, *slot, std::move(values[i]), inserted);
+            if (inserted) size_++;
+        }
+    }
 }
 
 // Erases a key from the map, no effect if it is not present. Returns indication whether any deletion occurred.
-bool Store::del(const std::string &key) { return map_.erase(key); }
+bool Store::del(const std::string &key) {
+    std::size_t hash = hashKey_(key);
+    Shard &shard = shardFor_(hash);
+    ShardLock lock(shard.mtx);
+    if (reclaimIfExpired_(shard, key, hash)) return false;
+    Slot *found = shard.map.findSlot(key, hash);
+    if (!found) return false;
+    clearExpiry_(shard, key, hash);
+    removeSlot_(shard, found);
+    size_--;
+    return true;
+}
 
 // Updates a key's value. Returns true if updated, false if the key does not exist.
-bool Store::update(const std::string &key, StoreValueSP value) {
-    if (!contains(key)) return false;
-    map_[key] = value;
+bool Store::update(const std::string &key, StoreValue value) {
+    std::size_t hash = hashKey_(key);
+    Shard &shard = shardFor_(hash);
+    ShardLock lock(shard.mtx);
+    if (reclaimIfExpired_(shard, key, hash)) return false;
+    Slot *found = shard.map.findSlot(key, hash);
+    if (!found) return false;
+    assign_(shard, *found, std::move(value), false);
     return true;
 }
 
 // Resolves recursive references (keys storing other keys) until a base value is reached.
 // Essentially, a recursive GET command for when the user wants to unpack a key-chain.
-StoreValueSP Store::resolve(const std::string &key, bool resolveIdentsInList) const {
-    // Set of keys that have been explored to prevent circular references
-    std::unordered_set<std::string> seen;
-    return resolveRecur_(key, seen, resolveIdentsInList);
+StoreValue Store::resolve(const std::string &key, bool resolveIdentsInList) const {
+    std::vector<std::string> lists;
+    return resolveRecur_(key, lists, resolveIdentsInList);
 }
 
-StoreValueSP Store::resolveRecur_(
-    const std::string &key, std::unordered_set<std::string> &seen, bool resolveIdentsInList) const {
-    // If a key is being searched for again, there is a circular ref
-    if (seen.count(key)) throw RuntimeErr(CIRCULAR_REF);
-    seen.insert(key);
+// `lists` holds the keys of the lists being resolved, an element leading back to one of which is
+// a circular reference. Cycles among aliases are caught on the way.
+StoreValue Store::resolveRecur_(
+    const std::string &key, std::vector<std::string> &lists, bool resolveIdentsInList) const {
+    StoreValue found;
+    std::string resolvedKey;
+    auto copy = [&found](const std::string &, StoreValue &v) {
+        found = v;
+        return StoreResult::OK;
+    };
+    const_cast<Store *>(this)->modifyResolved_(key, copy, &resolvedKey);
 
-    StoreValueSP found = get(key);
-    if (!found) return nullptr;
+    // Resolve list elements (in case there are identifiers) only if requested
+    if (found.getValueType() != ValueType::LIST || !resolveIdentsInList) return found;
+    if (std::find(lists.begin(), lists.end(), resolvedKey) != lists.end())
+        throw RuntimeErr(CIRCULAR_REF);
 
-    // If another identifier is found, continue down the chain
-    if (found->getValueType() == ValueType::IDENTIFIER) {
-        IdentifierValueSP ident = std::dynamic_pointer_cast<IdentifierValue>(found);
-        return resolveRecur_(ident->getValue(), seen, resolveIdentsInList);
+    lists.push_back(resolvedKey);
+    ListValue &resolvedL = found.getList();
+    for (std::size_t i = 0; i < resolvedL.length(); i++) {
+        const StoreValue &item = resolvedL.getValue()[i];
+        if (item.getValueType() == ValueType::IDENTIFIER)
+            resolvedL.replace(i, resolveRecur_(item.getString(), lists, resolveIdentsInList));
     }
+    lists.pop_back();
+    return found;
+}
+
+// Follows the alias chain from a key and applies `modify` to the key it ends at and its value,
+// giving that key in `resolvedKey` (if not null). Each hop only holds one shard lock, and the final
+// value is modified under its own. A chain seen before is skipped over through the alias cache.
+template <typename F>
+StoreResult Store::modifyResolved_(const std::string &key, F modify, std::string *resolvedKey) {
+    std::vector<std::string> chain;
+    std::unordered_set<std::string> seen; // Only for chains too long to go over
+    int64_t chainExpiresAt = NO_EXPIRY;
+    uint64_t epoch = aliasEpoch_.load();
+    bool jumped = false;
+    std::string curr = key;
+    StoreResult result;
+
+    while (true) {
+        std::size_t hash = hashKey_(curr);
+        Shard &shard = shardFor_(hash);
+        ShardLock lock(shard.mtx);
 
-    // Resolve list elements (in case there are identifiers) only if requested (makes a copy)
-    if (found->getValueType() == ValueType::LIST && resolveIdentsInList) {
-        ListValueSP listValue = std::dynamic_pointer_cast<ListValue>(found);
+        if (reclaimIfExpired_(shard, curr, hash)) return StoreResult::NOT_FOUND;
+        Slot *found = shard.map.findSlot(curr, hash);
+        if (!found) return StoreResult::NOT_FOUND;
 
-        std::vector<StoreValueSP> resolvedL = std::vector<StoreValueSP>(listValue->getValue());
-        for (std::size_t i = 0; i < resolvedL.size(); i++) {
-            if (!resolvedL[i]) continue;
-            if (resolvedL[i]->getValueType() == ValueType::IDENTIFIER) {
-                // Each element should inherit parent history
-                std::unordered_set<std::string> newSeen = std::unordered_set<std::string>(seen);
+        if (found->value.getValueType() == ValueType::IDENTIFIER) {
+            // Only the first alias jumps, so that a chain changed since keeps being followed
+            if (chain.empty() && !jumped && cachedAlias_(curr, curr)) {
+                jumped = true;
+                continue;
+            }
 
-                IdentifierValueSP ident = std::dynamic_pointer_cast<IdentifierValue>(resolvedL[i]);
-                resolvedL[i] = resolveRecur_(ident->getValue(), newSeen, resolveIdentsInList);
+            if (chain.size() < STORE_ALIAS_LINEAR_HOPS) {
+                if (std::find(chain.begin(), chain.end(), curr) != chain.end())
+                    throw RuntimeErr(CIRCULAR_REF);
+            } else {
+                if (seen.empty()) seen.insert(chain.begin(), chain.end());
+                if (!seen.insert(curr).second) throw RuntimeErr(CIRCULAR_REF);
+            }
+            if (!shard.expires.empty()) {
+                const int64_t *expiresAt = shard.expires.find(curr, hash);
+                if (expiresAt && (chainExpiresAt == NO_EXPIRY || *expiresAt < chainExpiresAt))
+                    chainExpiresAt = *expiresAt;
             }
+            chain.push_back(curr);
+            curr = found->value.getString();
+            continue;
         }
-        return std::make_shared<ListValue>(resolvedL);
+
+        touch_(*found, false);
+        std::size_t before = found->value.size();
+        result = modify(found->key, found->value);
+        resized_(found->value, before);
+        break;
     }
 
-    return found;
+    if (!jumped && !chain.empty()) cacheAlias_(chain, curr, chainExpiresAt, epoch);
+    if (resolvedKey) *resolvedKey = std::move(curr);
+    return result;
+}
+
+bool Store::cachedAlias_(const std::string &alias, std::string &target) {
+    std::lock_guard<std::mutex> lock(aliasMtx_);
+    auto it = aliasTargets_.find(alias);
+    if (it == aliasTargets_.end()) return false;
+
+    // Past it, an alias on the chain is gone even if it hasn't been reclaimed yet
+    int64_t expiresAt = it->second.expiresAt;
+    if (expiresAt != NO_EXPIRY && expiresAt <= nowMs()) {
+        dropAlias_(alias);
+        return false;
+    }
+    target = it->second.key;
+    return true;
+}
+
+// Caches the chain from its first alias, until `expiresAt` (the soonest deadline of its aliases),
+// unless an alias changed since it was first read (at `epoch`). The cache is emptied when full.
+void Store::cacheAlias_(std::vector<std::string> &chain, const std::string &target,
+    int64_t expiresAt, uint64_t epoch) {
+    std::lock_guard<std::mutex> lock(aliasMtx_);
+    if (aliasEpoch_.load() != epoch) return;
+    if (aliasTargets_.size() >= STORE_ALIAS_CACHE_SIZE) {
+        aliasTargets_.clear();
+        aliasesThrough_.clear();
+        memory_ -= aliasMemory_;
+        aliasMemory_ = 0;
+    }
+
+    std::string alias = chain.front();
+    dropAlias_(alias);
+    chain.push_back(target);
+    std::size_t bytes = 0;
+    for (const std::string &key : chain) {
+        auto through = aliasesThrough_.find(key);
+        if (through == aliasesThrough_.end()) {
+            through = aliasesThrough_.emplace(key, std::unordered_set<std::string>()).first;
+            bytes += throughListMemory(key);
+        }
+        if (through->second.insert(alias).second) bytes += throughAliasMemory(alias);
+    }
+    AliasTarget &cached = aliasTargets_[alias];
+    cached = AliasTarget { target, std::move(chain), expiresAt };
+    bytes += aliasTargetMemory(alias, cached);
+    aliasMemory_ += bytes;
+    memory_ += bytes;
+}
+
+// Drops the cached chains running through a key about to become, or stop being, an alias.
+void Store::invalidateAliases_(const std::string &key) {
+    std::lock_guard<std::mutex> lock(aliasMtx_);
+    aliasEpoch_++;
+    auto it = aliasesThrough_.find(key);
+    if (it == aliasesThrough_.end()) return;
+
+    std::unordered_set<std::string> aliases = std::move(it->second);
+    aliasesThrough_.erase(it);
+    std::size_t bytes = throughListMemory(key);
+    for (const std::string &alias : aliases)
+        bytes += throughAliasMemory(alias);
+    aliasMemory_ -= bytes;
+    memory_ -= bytes;
+    for (const std::string &alias : aliases)
+        dropAlias_(alias);
+}
+
+void Store::dropAlias_(const std::string &alias) {
+    auto it = aliasTargets_.find(alias);
+    if (it == aliasTargets_.end()) return;
+
+    std::size_t bytes = aliasTargetMemory(alias, it->second);
+    for (const std::string &key : it->second.chain) {
+        auto through = aliasesThrough_.find(key);
+        if (through == aliasesThrough_.end()) continue;
+        if (through->second.erase(alias)) bytes += throughAliasMemory(alias);
+        if (!through->second.empty()) continue;
+        aliasesThrough_.erase(through);
+        bytes += throughListMemory(key);
+    }
+    aliasTargets_.erase(it);
+    aliasMemory_ -= bytes;
+    memory_ -= bytes;
+}
+
+StoreResult Store::incr(const std::string &key) {
+    return modifyResolved_(key, [](const std::string &, StoreValue &v) {
+        if (!v.isNumeric()) return StoreResult::WRONG_TYPE;
+        v.incr();
+        return StoreResult::OK;
+    });
+}
+
+StoreResult Store::decr(const std::string &key) {
+    return modifyResolved_(key, [](const std::string &, StoreValue &v) {
+        if (!v.isNumeric()) return StoreResult::WRONG_TYPE;
+        v.decr();
+        return StoreResult::OK;
+    });
+}
+
+StoreResult Store::append(const std::string &key, StoreValue item) {
+    return modifyResolved_(key, [this, &item](const std::string &owner, StoreValue &v) {
+        if (v.getValueType() != ValueType::LIST) return StoreResult::WRONG_TYPE;
+        addRefs_(owner, item);
+        v.getList().append(std::move(item));
+        return StoreResult::OK;
+    });
+}
+
+StoreResult Store::prepend(const std::string &key, StoreValue item) {
+    return modifyResolved_(key, [this, &item](const std::string &owner, StoreValue &v) {
+        if (v.getValueType() != ValueType::LIST) return StoreResult::WRONG_TYPE;
+        addRefs_(owner, item);
+        v.getList().prepend(std::move(item));
+        return StoreResult::OK;
+    });
+}
+
+StoreResult Store::popFront(const std::string &key, StoreValue &out) {
+    return modifyResolved_(key, [this, &out](const std::string &owner, StoreValue &v) {
+        if (v.getValueType() != ValueType::LIST) return StoreResult::WRONG_TYPE;
+        if (!v.getList().length()) return StoreResult::OUT_OF_RANGE;
+        out = v.getList().popFront();
+        dropRefs_(owner, out);
+        return StoreResult::OK;
+    });
+}
+
+StoreResult Store::popBack(const std::string &key, StoreValue &out) {
+    return modifyResolved_(key, [this, &out](const std::string &owner, StoreValue &v) {
+        if (v.getValueType() != ValueType::LIST) return StoreResult::WRONG_TYPE;
+        if (!v.getList().length()) return StoreResult::OUT_OF_RANGE;
+        out = v.getList().popBack();
+        dropRefs_(owner, out);
+        return StoreResult::OK;
+    });
+}
+
+// Keeps only the items in an inclusive range, emptying the list if none are in it.
+StoreResult Store::trim(const std::string &key, long start, long stop) {
+    return modifyResolved_(key, [this, start, stop](const std::string &owner, StoreValue &v) {
+        if (v.getValueType() != ValueType::LIST) return StoreResult::WRONG_TYPE;
+
+        ListValue &list = v.getList();
+        std::size_t from, to;
+        if (!list.toRange(start, stop, from, to)) from = to = list.length();
+        const ListItems &items = list.getValue();
+        for (std::size_t i = 0; i < from; i++)
+            dropRefs_(owner, items[i]);
+        for (std::size_t i = to; i < items.size(); i++)
+            dropRefs_(owner, items[i]);
+        list.trim(from, to);
+        return StoreResult::OK;
+    });
+}
+
+// Reads go through modifyResolved_ as well, to copy out only what was asked for under the lock
+StoreResult Store::index(const std::string &key, long i, StoreValue &out) const {
+    auto read = [i, &out](const std::string &, StoreValue &v) {
+        if (v.getValueType() != ValueType::LIST) return StoreResult::WRONG_TYPE;
+
+        std::size_t from, to;
+        if (!v.getList().toRange(i, i, from, to)) return StoreResult::OUT_OF_RANGE;
+        out = v.getList().getValue()[from];
+        return StoreResult::OK;
+    };
+    return const_cast<Store *>(this)->modifyResolved_(key, read);
+}
+
+StoreResult Store::range(const std::string &key, long start, long stop, StoreValue &out) const {
+    auto read = [start, stop, &out](const std::string &, StoreValue &v) {
+        if (v.getValueType() != ValueType::LIST) return StoreResult::WRONG_TYPE;
+
+        const ListItems &items = v.getList().getValue();
+        ListItems slice;
+        std::size_t from, to;
+        if (v.getList().toRange(start, stop, from, to))
+            slice.assign(items.begin() + from, items.begin() + to);
+        out = StoreValue::makeList(std::move(slice));
+        return StoreResult::OK;
+    };
+    return const_cast<Store *>(this)->modifyResolved_(key, read);
 }
 
 // Renames a value's key. WARNING: if `newName` was already present in the store, its value will be overwritten.
-void Store::rename(const std::string &oldName, const std::string &newName) {
-    StoreValueSP val = get(oldName);
-    if (!val) return;
+void Store::rename(const std::string &oldName, const std::string &newName, bool cascade) {
+    if (moveKey_(oldName, newName) && cascade && oldName != newName)
+        retargetRefs_(oldName, newName);
+}
+
+// Returns whether the old key was there to move.
+bool Store::moveKey_(const std::string &oldName, const std::string &newName) {
+    std::size_t oldHash = hashKey_(oldName), newHash = hashKey_(newName);
+    Shard &oldShard = shardFor_(oldHash);
+    Shard &newShard = shardFor_(newHash);
+
+    // Both shards are held so the key is never observed missing from (or in) both
+    std::unique_lock<std::mutex> oldLock(oldShard.mtx, std::defer_lock);
+    std::unique_lock<std::mutex> newLock(newShard.mtx, std::defer_lock);
+    if (&oldShard == &newShard)
+        oldLock.lock();
+    else
+        std::lock(oldLock, newLock);
+
+    // Delete old key, insert again, carrying its deadline over
+    if (reclaimIfExpired_(oldShard, oldName, oldHash)) return false;
+    Slot *found = oldShard.map.findSlot(oldName, oldHash);
+    if (!found) return false;
+    StoreValue val;
+    removeSlot_(oldShard, found, &val);
+    int64_t expiresAt = expiryOf_(oldShard, oldName, oldHash);
+    clearExpiry_(oldShard, oldName, oldHash);
+    setExpiry_(newShard, newName, newHash, expiresAt);
+    bool inserted;
+    Slot *slot = newShard.map.findOrInsert(newName, newHash, inserted);
+    assign_(newShard, *slot, std::move(val), inserted);
+    if (!inserted) size_--;
+    return true;
+}
+
+// Points a value's references to one key at another instead. Returns whether any changed.
+static bool retarget(StoreValue &value, const std::string &from, const std::string &to) {
+    if (value.getValueType() == ValueType::IDENTIFIER) {
+        if (value.getString() != from) return false;
+        value = StoreValue::makeIdentifier(to);
+        return true;
+    }
+    if (value.getValueType() != ValueType::LIST) return false;
+
+    ListValue &list = value.getList();
+    bool changed = false;
+    for (std::size_t i = 0; i < list.length(); i++) {
+        ValueType type = list.getValue()[i].getValueType();
+        if (type != ValueType::IDENTIFIER && type != ValueType::LIST) continue;
+
+        StoreValue item = list.getValue()[i];
+        if (!retarget(item, from, to)) continue;
+        list.replace(i, std::move(item));
+        changed = true;
+    }
+    return changed;
+}
 
-    // Delete old key, insert again
-    map_.erase(oldName);
-    map_[newName] = val;
+// Rewrites the keys referring to `from` to refer to `to`, one at a time under its own shard lock.
+void Store::retargetRefs_(const std::string &from, const std::string &to) {
+    for (const std::string &referrer : referrersOf_(from)) {
+        std::size_t hash = hashKey_(referrer);
+        Shard &shard = shardFor_(hash);
+        ShardLock lock(shard.mtx);
+        if (reclaimIfExpired_(shard, referrer, hash)) continue;
+        Slot *found = shard.map.findSlot(referrer, hash);
+        if (!found) continue;
+
+        StoreValue value = found->value;
+        if (retarget(value, from, to)) assign_(shard, *found, std::move(value), false);
+    }
+}
+
+// Skips keys past their deadline, which still hold their references until reclaimed.
+std::vector<std::string> Store::referrers(const std::string &key) const {
+    std::vector<std::string> keys = referrersOf_(key);
+    keys.erase(std::remove_if(keys.begin(), keys.end(),
+                   [this](const std::string &referrer) { return !contains(referrer); }),
+        keys.end());
+    std::sort(keys.begin(), keys.end());
+    return keys;
 }
 
-// Searches for keys matching the given regex pattern.
-std::vector<std::string> Store::search(const std::string &regexPattern) const {
+std::vector<std::string> Store::referrersOf_(const std::string &key) const {
+    const Shard &shard = shardFor_(hashKey_(key));
+    std::lock_guard<std::mutex> lock(shard.refsMtx);
     std::vector<std::string> keys;
-    std::regex re(regexPattern);
+    auto it = shard.refs.find(key);
+    if (it == shard.refs.end()) return keys;
 
-    for (const auto &pair : map_) {
-        if (std::regex_match(pair.first, re)) {
-            keys.push_back(pair.first);
-        }
+    keys.reserve(it->second.size());
+    for (const auto &referrer : it->second)
+        keys.push_back(referrer.first);
+    return keys;
+}
+
+// Visits the keys from `from` on in each shard's index while inRange(key) holds, collecting those
+// that match the pattern (if any) and have not expired. Keys are matched a batch at a time. Each
+// shard's run comes out sorted, then they are merged.
+template <typename InRange>
+std::vector<std::string> Store::scanKeys_(
+    const std::string &from, InRange inRange, const Pattern *pattern) const {
+    std::vector<std::string> keys;
+    KeyBatch batch;
+    std::vector<std::size_t> matched;
+    auto matchBatch = [&]() {
+        matched.clear();
+        pattern->matchBatch(batch, matched);
+        for (std::size_t i : matched)
+            keys.push_back(batch.key(i));
+        batch.clear();
+    };
+
+    for (const Shard &shard : shards_) {
+        ShardLock lock(shard.mtx);
+        std::size_t runStart = keys.size();
+        shard.index.scan(from, [&](const std::string &key) {
+            if (!inRange(key)) return false;
+            if (!shard.expires.empty() && isExpired_(shard, key, hashKey_(key))) return true;
+
+            if (!pattern) {
+                keys.push_back(key);
+            } else {
+                batch.add(key);
+                if (batch.full()) matchBatch();
+            }
+            return true;
+        });
+        if (batch.size()) matchBatch();
+        std::inplace_merge(keys.begin(), keys.begin() + runStart, keys.end());
     }
     return keys;
 }
 
-// Serializes the Store into binary at the filename specified.
-void Store::saveToFile(const std::string &filename) const {
-    std::ofstream fp;
-    fp.open(filename, std::ios::out | std::ios::binary);
-    if (!fp.is_open()) throw RuntimeErr(FAIL_OPEN_WRITE);
+std::vector<std::string> Store::search(const std::string &source, PatternSyntax syntax) const {
+    std::shared_ptr<const Pattern> pattern = patterns_.get(source, syntax);
+    const std::string &prefix = pattern->prefix();
+    if (pattern->isLiteral()) {
+        std::vector<std::string> keys;
+        if (contains(prefix)) keys.push_back(prefix);
+        return keys;
+    }
+
+    return scanKeys_(
+        prefix, [&](const std::string &key) { return !key.compare(0, prefix.size(), prefix); },
+        pattern.get());
+}
+
+// The first `count` keys after the cursor are among the first `count` of each shard, so no shard
+// is walked further than that.
+std::string Store::scan(const std::string &cursor, std::size_t count,
+    std::vector<std::string> &keys, const std::string &match) const {
+    if (!count) return cursor;
+
+    std::shared_ptr<const Pattern> pattern;
+    if (!match.empty()) pattern = patterns_.get(match, PatternSyntax::GLOB);
+
+    std::vector<std::pair<std::string, bool>> visited; // Keys, and whether they are live
+    bool more = false;
+    for (const Shard &shard : shards_) {
+        ShardLock lock(shard.mtx);
+        std::size_t taken = 0;
+        shard.index.scan(cursor, [&](const std::string &key) {
+            if (key == cursor) return true;
+            if (taken == count) {
+                more = true;
+                return false;
+            }
+            taken++;
+            visited.emplace_back(
+                key, shard.expires.empty() || !isExpired_(shard, key, hashKey_(key)));
+            return true;
+        });
+    }
+
+    std::sort(visited.begin(), visited.end());
+    if (visited.size() > count) {
+        visited.resize(count);
+        more = true;
+    }
+    for (const auto &key : visited)
+        if (key.second && (!pattern || pattern->matches(key.first))) keys.push_back(key.first);
+    return more ? visited.back().first : "";
+}
+
+std::vector<std::string> Store::searchPrefix(const std::string &prefix) const {
+    return scanKeys_(
+        prefix, [&](const std::string &key) { return !key.compare(0, prefix.size(), prefix); },
+        nullptr);
+}
+
+std::vector<std::string> Store::searchRange(const std::string &from, const std::string &to) const {
+    return scanKeys_(from, [&](const std::string &key) { return key <= to; }, nullptr);
+}
+
+void Store::forEach(const ItemVisitor &visit) const {
+    forEach_([&visit](const std::string &key, const StoreValue &value, int64_t) {
+        visit(key, value);
+    });
+}
+
+bool Store::expireAt(const std::string &key, int64_t expiresAt) {
+    std::size_t hash = hashKey_(key);
+    Shard &shard = shardFor_(hash);
+    ShardLock lock(shard.mtx);
+    if (reclaimIfExpired_(shard, key, hash)) return false;
+    Slot *found = shard.map.findSlot(key, hash);
+    if (!found) return false;
+
+    setExpiry_(shard, key, hash, expiresAt);
+    // Chains cached through an alias were jumped over without its deadline
+    if (found->value.getValueType() == ValueType::IDENTIFIER) invalidateAliases_(key);
+    return true;
+}
+
+bool Store::persist(const std::string &key) {
+    std::size_t hash = hashKey_(key);
+    Shard &shard = shardFor_(hash);
+    ShardLock lock(shard.mtx);
+    if (reclaimIfExpired_(shard, key, hash) || !shard.map.find(key, hash)) return false;
+    clearExpiry_(shard, key, hash);
+    return true;
+}
+
+int64_t Store::ttl(const std::string &key) const {
+    std::size_t hash = hashKey_(key);
+    const Shard &shard = shardFor_(hash);
+    ShardLock lock(shard.mtx);
+    if (!shard.map.find(key, hash)) return -2;
+
+    int64_t expiresAt = expiryOf_(shard, key, hash);
+    if (expiresAt == NO_EXPIRY) return -1;
+
+    int64_t left = expiresAt - nowMs();
+    return left > 0 ? left : -2;
+}
+
+// Each shard's wheel hands over the deadlines that came due, and those still current are reclaimed.
+// Past the per-round budget, due entries go back on the wheel to come due again next round.
+std::size_t Store::activeExpire() {
+    if (!expiring_.load(std::memory_order_relaxed)) return 0;
+
+    int64_t now = nowMs();
+    if (now - lastExpireCycle_.load(std::memory_order_relaxed) < STORE_EXPIRE_CYCLE_MS) return 0;
+    lastExpireCycle_.store(now, std::memory_order_relaxed);
+
+    std::size_t reclaimed = 0;
+    std::vector<TimerWheel::Entry> due;
+    for (Shard &shard : shards_) {
+        ShardLock lock(shard.mtx);
+        due.clear();
+
+        std::size_t wheelBytes = shard.wheel.bytes();
+        shard.wheel.advance(now, due);
+
+        std::size_t budget = STORE_EXPIRE_CYCLE_KEYS;
+        for (TimerWheel::Entry &entry : due) {
+            if (!budget) {
+                shard.wheel.schedule(std::move(entry.key), entry.hash, entry.deadline);
+                continue;
+            }
+
+            // A deadline pushed back since wasn't scheduled again, so it is now
+            const int64_t *expiresAt = shard.expires.find(entry.key, entry.hash);
+            if (expiresAt && *expiresAt > now) {
+                shard.wheel.schedule(std::move(entry.key), entry.hash, *expiresAt);
+                continue;
+            }
+            if (reclaimIfExpired_(shard, entry.key, entry.hash, now)) {
+                reclaimed++;
+                budget--;
+            }
+        }
+        memory_ += shard.wheel.bytes();
+        memory_ -= wheelBytes;
+    }
+    return reclaimed;
+}
+
+bool Store::isExpired_(const Shard &shard, const std::string &key, std::size_t hash) const {
+    if (shard.expires.empty()) return false;
+    const int64_t *expiresAt = shard.expires.find(key, hash);
+    return expiresAt && *expiresAt <= nowMs();
+}
+
+int64_t Store::expiryOf_(const Shard &shard, const std::string &key, std::size_t hash) const {
+    if (shard.expires.empty()) return NO_EXPIRY;
+    const int64_t *expiresAt = shard.expires.find(key, hash);
+    return expiresAt ? *expiresAt : NO_EXPIRY;
+}
+
+void Store::setExpiry_(Shard &shard, const std::string &key, std::size_t hash, int64_t expiresAt) {
+    if (expiresAt == NO_EXPIRY) {
+        clearExpiry_(shard, key, hash);
+        return;
+    }
+
+    // Every key with a deadline has a wheel entry due no later than it. Entries can't be cancelled,
+    // so a deadline pushed back keeps its entry, and is scheduled again once that falls due.
+    int64_t *current = shard.expires.find(key, hash);
+    if (current) {
+        bool earlier = expiresAt < *current;
+        *current = expiresAt;
+        if (!earlier) return;
+    } else {
+        shard.expires.insertOrAssign(key, hash, expiresAt);
+        expiring_++;
+        memory_ += deadlineMemory(key);
+    }
+
+    std::size_t wheelBytes = shard.wheel.bytes();
+    shard.wheel.schedule(key, hash, expiresAt);
+    memory_ += shard.wheel.bytes() - wheelBytes;
+}
+
+void Store::clearExpiry_(Shard &shard, const std::string &key, std::size_t hash) {
+    if (!shard.expires.empty() && shard.expires.erase(key, hash)) {
+        expiring_--;
+        memory_ -= deadlineMemory(key);
+    }
+}
+
+// Removes the key if it is past its deadline (as of `now`, or the clock if negative). Returns
+// whether it was.
+bool Store::reclaimIfExpired_(Shard &shard, const std::string &key, std::size_t hash, int64_t now) {
+    if (shard.expires.empty()) return false;
+    const int64_t *expiresAt = shard.expires.find(key, hash);
+    if (!expiresAt) return false;
+    if (now < 0) now = nowMs();
+    if (*expiresAt > now) return false;
+
+    shard.expires.erase(key, hash);
+    expiring_--;
+    memory_ -= deadlineMemory(key);
+    if (Slot *found = shard.map.findSlot(key, hash)) {
+        removeSlot_(shard, found);
+        size_--;
+    }
+    return true;
+}
+
+// Counts the table slot and its control byte, plus the key and value's heap, plus the key's copy in
+// the index.
+std::size_t Store::itemMemory(const std::string &key, const StoreValue &value) {
+    return sizeof(Slot) + 1 + keyHeap(key) + value.size() - sizeof(StoreValue)
+        + sizeof(std::string) + keyHeap(key);
+}
+
+// A slot of the deadlines' table and its control byte, plus the key's heap. The key's entries on
+// the timer wheel are counted as the wheel grows and shrinks.
+std::size_t Store::deadlineMemory(const std::string &key) {
+    return sizeof(FlatHashMap<int64_t>::Slot) + 1 + keyHeap(key);
+}
+
+void Store::assign_(Shard &shard, Slot &slot, StoreValue &&value, bool inserted) {
+    bool wasAlias = !inserted && slot.value.getValueType() == ValueType::IDENTIFIER;
+    if (wasAlias || value.getValueType() == ValueType::IDENTIFIER) invalidateAliases_(slot.key);
 
-    fp.write(FILE_HEADER.data(), FILE_HEADER_SIZE);
+    if (inserted) {
+        shard.index.insert(slot.key);
+    } else {
+        memory_ -= itemMemory(slot.key, slot.value);
+        dropRefs_(slot.key, slot.value);
+    }
+    addRefs_(slot.key, value);
+    slot.value = std::move(value);
+    memory_ += itemMemory(slot.key, slot.value);
+    touch_(slot, inserted);
+}
 
-    for (const auto &item : map_) {
-        // [key size][key][value]
-        const std::string &key = item.first;
-        StoreValueSP val = item.second;
+// Erases a slot, moving its value into `out` if given.
+void Store::removeSlot_(Shard &shard, Slot *slot, StoreValue *out) {
+    if (slot->value.getValueType() == ValueType::IDENTIFIER) invalidateAliases_(slot->key);
+    memory_ -= itemMemory(slot->key, slot->value);
+    dropRefs_(slot->key, slot->value);
+    if (out) *out = std::move(slot->value);
+    shard.index.erase(slot->key);
+    shard.map.erase(slot);
+}
 
-        size_t keySize = key.size();
-        fp.write(reinterpret_cast<const char *>(&keySize), sizeof(keySize));
-        fp.write(key.data(), keySize);
-        fp.WRITE_DELIM;
-        val->toFile(fp);
+// Calls f(key) on every key a value refers to, once per reference.
+template <typename F>
+static void forEachRef(const StoreValue &value, F &&f) {
+    if (value.getValueType() == ValueType::IDENTIFIER) {
+        f(value.getString());
+    } else if (value.getValueType() == ValueType::LIST) {
+        for (const StoreValue &item : value.getList().getValue())
+            forEachRef(item, f);
     }
-    fp.close();
 }
 
-// Deserializes a binary KEPLER-SAVE file into a Store with all its data.
-void Store::loadFromFile(const std::string &filename) {
-    std::ifstream fp;
-    fp.open(filename, std::ios::in | std::ios::binary);
-    if (!fp.is_open()) throw RuntimeErr(FAIL_OPEN_READ);
+void Store::addRefs_(const std::string &referrer, const StoreValue &value) {
+    forEachRef(value, [&](const std::string &target) { addRef_(referrer, target); });
+}
 
-    // Confirm file header tag by filling empty buffer
-    std::string expectHeader(FILE_HEADER_SIZE, '\0');
-    fp.read(&expectHeader[0], FILE_HEADER_SIZE);
-    if (expectHeader != FILE_HEADER) throw RuntimeErr(NOT_VALID_SAVE);
+void Store::dropRefs_(const std::string &referrer, const StoreValue &value) {
+    forEachRef(value, [&](const std::string &target) { dropRef_(referrer, target); });
+}
 
-    while (fp.peek() != EOF) {
-        size_t keySize;
-        fp.read(reinterpret_cast<char *>(&keySize), sizeof(keySize));
-        std::string key(keySize, '\0');
-        fp.read(&key[0], keySize);
-        fp.MV_FP_FORWARD;
+// A key referred to in its shard's refs, and one key referring to it.
+static inline std::size_t refTargetMemory(const std::string &target) {
+    return hashNodeMemory<std::pair<const std::string, std::unordered_map<std::string, uint32_t>>>()
+        + keyHeap(target);
+}
 
-        map_[key] = StoreValue::fromFile(fp);
+static inline std::size_t referrerMemory(const std::string &referrer) {
+    return hashNodeMemory<std::pair<const std::string, uint32_t>>() + keyHeap(referrer);
+}
+
+void Store::addRef_(const std::string &referrer, const std::string &target) {
+    Shard &shard = shardFor_(hashKey_(target));
+    std::lock_guard<std::mutex> lock(shard.refsMtx);
+    auto it = shard.refs.find(target);
+    if (it == shard.refs.end()) {
+        it = shard.refs.emplace(target, std::unordered_map<std::string, uint32_t>()).first;
+        memory_ += refTargetMemory(target);
     }
-    fp.close();
+    if (++it->second[referrer] == 1) memory_ += referrerMemory(referrer);
+}
+
+void Store::dropRef_(const std::string &referrer, const std::string &target) {
+    Shard &shard = shardFor_(hashKey_(target));
+    std::lock_guard<std::mutex> lock(shard.refsMtx);
+    auto it = shard.refs.find(target);
+    if (it == shard.refs.end()) return;
+    auto count = it->second.find(referrer);
+    if (count == it->second.end()) return;
+
+    if (--count->second) return;
+    it->second.erase(count);
+    memory_ -= referrerMemory(referrer);
+    if (!it->second.empty()) return;
+    shard.refs.erase(it);
+    memory_ -= refTargetMemory(target);
+}
+
+void Store::resized_(const StoreValue &value, std::size_t before) {
+    std::size_t after = value.size();
+    if (after > before)
+        memory_ += after - before;
+    else
+        memory_ -= before - after;
+}
+
+// Records an access in the slot's spare word: the time for LRU, a decayed then maybe incremented
+// counter for LFU. New keys start from a small count, so they are not evicted straight away.
+void Store::touch_(Slot &slot, bool inserted) const {
+    if (!tracksAccess_()) return;
+
+    int64_t now = steadyMs();
+    if (!isLfu(policy_)) {
+        slot.meta = (uint32_t) now;
+        return;
+    }
+
+    uint8_t counter = inserted ? STORE_LFU_INITIAL : lfuIncremented(lfuDecayed(slot.meta, now));
+    slot.meta = lfuPeriod(now) << 8 | counter;
+}
+
+void Store::setMaxMemory(std::size_t bytes, EvictionPolicy policy) {
+    maxMemory_ = bytes;
+    policy_ = policy;
+}
+
+// Higher scores are evicted first: the time idle for LRU, how rarely used for LFU.
+uint64_t Store::evictionScore_(const Slot &slot, int64_t now) const {
+    if (isLfu(policy_)) return UINT8_MAX - lfuDecayed(slot.meta, now);
+    return (uint32_t) now - slot.meta;
+}
+
+bool Store::evict(std::vector<std::string> &evicted) {
+    if (!overMemoryLimit()) return true;
+    if (policy_ == EvictionPolicy::NOEVICTION) return false;
+
+    std::lock_guard<std::mutex> lock(evictMtx_);
+    while (overMemoryLimit()) {
+        // Shards are sampled in turn until the pool yields a candidate that is still there to
+        // evict. A whole round of them without one means there is nothing left to evict.
+        bool found = false;
+        for (std::size_t tries = 0; !found && tries < STORE_NUM_SHARDS; tries++) {
+            sampleForEviction_(shards_[evictCursor_++ % STORE_NUM_SHARDS]);
+            while (!found && !evictionPool_.empty()) {
+                EvictionCandidate best = std::move(evictionPool_.back());
+                evictionPool_.pop_back();
+                if (!evictCandidate_(best)) continue;
+                evicted.push_back(std::move(best.key));
+                found = true;
+            }
+        }
+        if (!found) return false;
+    }
+    return true;
+}
+
+// Volatile policies sample the keys with a deadline, the others sample all keys.
+void Store::sampleForEviction_(Shard &shard) {
+    ShardLock lock(shard.mtx);
+    int64_t now = steadyMs();
+    std::size_t start = randomBits();
+
+    if (!isVolatile(policy_)) {
+        shard.map.sample(start, STORE_EVICTION_SAMPLES,
+            [&](const Slot &slot) { addCandidate_(evictionScore_(slot, now), slot); });
+        return;
+    }
+
+    shard.expires.sample(start, STORE_EVICTION_SAMPLES,
+        [&](const FlatHashMap<int64_t>::Slot &expiry) {
+            const Slot *slot = shard.map.findSlot(expiry.key, expiry.hash);
+            if (slot) addCandidate_(evictionScore_(*slot, now), *slot);
+        });
+}
+
+// Keeps the pool ordered by score, replacing a key's earlier entry, and drops the least deserving
+// candidate once it is full.
+void Store::addCandidate_(uint64_t score, const Slot &slot) {
+    std::vector<EvictionCandidate> &pool = evictionPool_;
+    for (auto it = pool.begin(); it != pool.end(); ++it) {
+        if (it->hash != slot.hash || it->key != slot.key) continue;
+        pool.erase(it);
+        break;
+    }
+    if (pool.size() >= STORE_EVICTION_POOL && score <= pool.front().score) return;
+
+    auto pos = std::upper_bound(pool.begin(), pool.end(), score,
+        [](uint64_t s, const EvictionCandidate &c) { return s < c.score; });
+    pool.insert(pos, EvictionCandidate { score, slot.hash, slot.key });
+    if (pool.size() > STORE_EVICTION_POOL) pool.erase(pool.begin());
+}
+
+// Candidates may have been removed, or lost their deadline, since they were sampled.
+bool Store::evictCandidate_(const EvictionCandidate &candidate) {
+    Shard &shard = shardFor_(candidate.hash);
+    ShardLock lock(shard.mtx);
+    Slot *found = shard.map.findSlot(candidate.key, candidate.hash);
+    if (!found) return false;
+    if (isVolatile(policy_) && expiryOf_(shard, candidate.key, candidate.hash) == NO_EXPIRY)
+        return false;
+
+    clearExpiry_(shard, candidate.key, candidate.hash);
+    removeSlot_(shard, found);
+    size_--;
+    evicted_++;
+    return true;
 }
@@ -0,0 +1,339 @@
+#include "store.h"
+
+#include "byte_reader.h"
+#include "crc32c.h"
+#include "error_msgs.h"
+#include "file_io_macros.h"
+#include "mapped_file.h"
+#include "snapshot_format.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+// Serializes the Store into a versioned, block-structured binary at the filename specified.
+void Store::saveToFile(const std::string &filename) const {
+    std::ofstream fp;
+    fp.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!fp.is_open()) throw RuntimeErr(FAIL_OPEN_WRITE);
+
+    saveToStream(fp);
+    fp.close();
+    if (!fp) throw RuntimeErr(FAIL_OPEN_WRITE);
+}
+
+// Offsets within the snapshot are relative to where it starts, so it can be embedded in other
+// files.
+void Store::saveToStream(std::ostream &fp) const {
+    const std::streampos start = fp.tellp();
+
+    // Placeholder header, rewritten once the counts and offsets are known
+    SnapshotHeader header;
+    header.dataOffset = SnapshotHeader::encodedSize();
+    std::vector<uint8_t> bytes = header.encode();
+    fp.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+
+    std::vector<SnapshotIndexEntry> index;
+    std::vector<uint8_t> payload;
+    payload.reserve(SNAPSHOT_BLOCK_SIZE);
+    uint64_t offset = header.dataOffset;
+    uint32_t blockRecords = 0;
+
+    auto flushBlock = [&]() {
+        uint32_t payloadSize = payload.size();
+        uint32_t crc = crc32c(payload.data(), payload.size());
+        fp.write(reinterpret_cast<const char *>(&payloadSize), sizeof(payloadSize));
+        fp.write(reinterpret_cast<const char *>(&blockRecords), sizeof(blockRecords));
+        fp.write(reinterpret_cast<const char *>(&crc), sizeof(crc));
+        fp.write(reinterpret_cast<const char *>(payload.data()), payload.size());
+
+        index.push_back({ offset, blockRecords });
+        offset += SnapshotBlockHeader::ENCODED_SIZE + payload.size();
+        payload.clear();
+        blockRecords = 0;
+    };
+
+    forEach_([&](const std::string &key, const StoreValue &val, int64_t expiresAt) {
+        appendSnapshotRecord(payload, key, val, expiresAt);
+        blockRecords++;
+        header.keyCount++;
+        header.typeCounts[(std::size_t) val.getValueType()]++;
+        if (payload.size() >= SNAPSHOT_BLOCK_SIZE) flushBlock();
+    });
+    if (blockRecords) flushBlock();
+
+    // Trailing index of block offsets
+    header.blockCount = index.size();
+    header.indexOffset = offset;
+    bytes.clear();
+    for (const SnapshotIndexEntry &entry : index) {
+        appendRaw(bytes, entry.offset);
+        appendRaw(bytes, entry.recordCount);
+    }
+    appendRaw(bytes, crc32c(bytes.data(), bytes.size()));
+    fp.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+
+    const std::streampos end = fp.tellp();
+    bytes = header.encode();
+    fp.seekp(start);
+    fp.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    fp.seekp(end);
+
+    if (!fp) throw RuntimeErr(FAIL_OPEN_WRITE);
+}
+
+// What a background save's child process reports back through its pipe before exiting.
+struct BackgroundSaveReport {
+    uint64_t bytes;
+    uint64_t durationMs;
+};
+
+// Every shard is held across the fork, so no other thread can leave one locked mid-update in the
+// child. The child then has a copy-on-write image of the Store to work through at its own pace.
+pid_t Store::forkSnapshot() {
+    for (Shard &shard : shards_)
+        shard.mtx.lock();
+    pid_t pid = fork();
+    for (Shard &shard : shards_)
+        shard.mtx.unlock();
+    return pid;
+}
+
+// The file is written under a temporary name and renamed into place, so it never appears
+// half-written.
+void Store::saveToFileInBackground(const std::string &filename) {
+    reapBackgroundSave_(false);
+    if (bgSave_.state == BackgroundSaveInfo::State::RUNNING) throw RuntimeErr(BG_SAVE_RUNNING);
+
+    int fds[2];
+    if (pipe(fds) != 0) throw RuntimeErr(FAIL_BG_SAVE);
+
+    pid_t pid = forkSnapshot();
+    if (pid == 0) {
+        close(fds[0]);
+        auto start = std::chrono::steady_clock::now();
+        const std::string tmpName = filename + ".tmp";
+        try {
+            saveToFile(tmpName);
+            if (std::rename(tmpName.c_str(), filename.c_str()) != 0) _exit(EXIT_FAILURE);
+        } catch (...) {
+            std::remove(tmpName.c_str());
+            _exit(EXIT_FAILURE);
+        }
+
+        BackgroundSaveReport report;
+        std::ifstream written(filename, std::ios::binary | std::ios::ate);
+        report.bytes = (uint64_t) written.tellg();
+        report.durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start)
+                                .count();
+        bool sent = write(fds[1], &report, sizeof(report)) == (ssize_t) sizeof(report);
+
+        // Skip exit handlers and stdio flushing, which belong to the parent
+        _exit(sent ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        throw RuntimeErr(FAIL_BG_SAVE);
+    }
+
+    bgSavePid_ = pid;
+    bgSavePipe_ = fds[0];
+    bgSave_ = BackgroundSaveInfo();
+    bgSave_.state = BackgroundSaveInfo::State::RUNNING;
+    bgSave_.filename = filename;
+}
+
+const BackgroundSaveInfo &Store::backgroundSaveInfo() {
+    reapBackgroundSave_(false);
+    return bgSave_;
+}
+
+// Records the outcome of the background save once its child has exited, optionally blocking on it.
+void Store::reapBackgroundSave_(bool wait) {
+    if (bgSavePid_ <= 0) return;
+
+    int status;
+    pid_t done = waitpid(bgSavePid_, &status, wait ? 0 : WNOHANG);
+    if (done == 0) return;
+
+    BackgroundSaveReport report;
+    bool ok = done == bgSavePid_ && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS
+        && read(bgSavePipe_, &report, sizeof(report)) == (ssize_t) sizeof(report);
+    close(bgSavePipe_);
+    bgSavePid_ = -1;
+    bgSavePipe_ = -1;
+
+    if (ok) {
+        bgSave_.state = BackgroundSaveInfo::State::DONE;
+        bgSave_.bytes = report.bytes;
+        bgSave_.durationMs = report.durationMs;
+    } else {
+        bgSave_.state = BackgroundSaveInfo::State::FAILED;
+    }
+}
+
+// Deserializes a binary save file into a Store with all its data.
+// The file is memory-mapped and decoded in place rather than streamed through small reads.
+void Store::loadFromFile(const std::string &filename, const LoadVisitor &visit) {
+    MappedFile file(filename);
+    loadFromBytes(file.data(), file.size(), visit);
+}
+
+void Store::loadFromBytes(const char *data, std::size_t len, const LoadVisitor &visit) {
+    ByteReader reader(data, len);
+
+    // Unversioned files begin with the original header tag
+    if (reader.remaining() >= (std::size_t) FILE_HEADER_SIZE
+        && !FILE_HEADER.compare(0, FILE_HEADER_SIZE, data, FILE_HEADER_SIZE)) {
+        reader.skip(FILE_HEADER_SIZE);
+        loadV1_(reader, visit);
+    } else {
+        loadV2_(data, len, visit);
+    }
+}
+
+void Store::loadV1_(ByteReader &reader, const LoadVisitor &visit) {
+    // The header carries no key count, so a skip-only pass counts records to pre-size the shards
+    ByteReader counter = reader;
+    std::size_t numKeys = 0;
+    for (; !counter.atEnd(); numKeys++)
+        skipSnapshotRecord(counter);
+    reserve(size() + numKeys);
+
+    // Every record is decoded before any is merged, so a damaged file leaves the Store as it was
+    std::vector<LoadedItem> items(numKeys);
+    for (LoadedItem &item : items)
+        readSnapshotRecord(reader, item.key, item.value);
+    if (visit) {
+        for (const LoadedItem &item : items)
+            visit(item.key, item.value, NO_EXPIRY);
+    }
+    for (LoadedItem &item : items)
+        loadItem_(std::move(item.key), std::move(item.value), NO_EXPIRY);
+}
+
+// Blocks are decoded by a pool of workers. Each worker claims the next unread block, verifies it,
+// and builds its keys and values (including nested lists) into batches of its own, one per shard.
+// Only once every block checked out are the batches merged, a shard per worker at a time, so a
+// damaged file leaves the Store as it was.
+void Store::loadV2_(const char *data, std::size_t len, const LoadVisitor &visit) {
+    ByteReader reader(data, len);
+    SnapshotHeader header = SnapshotHeader::decode(reader);
+    std::vector<SnapshotIndexEntry> index = readSnapshotIndex(data, len, header);
+    reserve(size() + header.keyCount);
+
+    std::atomic<std::size_t> nextBlock(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorMtx;
+
+    std::size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::max<std::size_t>(1, std::min(numThreads, index.size()));
+    std::vector<std::array<std::vector<LoadedItem>, STORE_NUM_SHARDS>> staged(numThreads);
+
+    auto worker = [&](std::size_t w) {
+        try {
+            std::array<std::vector<LoadedItem>, STORE_NUM_SHARDS> &batches = staged[w];
+            std::size_t b;
+            while (!failed && (b = nextBlock++) < index.size()) {
+                ByteReader block = openSnapshotBlock(data, len, index[b]);
+                for (uint64_t i = 0; i < index[b].recordCount; i++) {
+                    LoadedItem item;
+                    readSnapshotRecord(block, item.key, item.value);
+                    if (header.version >= SNAPSHOT_EXPIRY_VERSION)
+                        item.expiresAt = readSnapshotExpiry(block);
+                    item.hash = hashKey_(item.key);
+                    batches[shardIndex_(item.hash)].push_back(std::move(item));
+                }
+                if (!block.atEnd()) throw RuntimeErr(CORRUPT_SAVE);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMtx);
+            if (!error) error = std::current_exception();
+            failed = true;
+        }
+    };
+
+    // The calling thread works too, so only spawn the rest
+    auto runPool = [numThreads](const std::function<void(std::size_t)> &work) {
+        std::vector<std::thread> pool;
+        for (std::size_t w = 1; w < numThreads; w++)
+            pool.emplace_back(work, w);
+        work(0);
+        for (std::thread &t : pool)
+            t.join();
+    };
+
+    runPool(worker);
+    if (error) std::rethrow_exception(error);
+    if (visit) {
+        for (const auto &batches : staged)
+            for (const std::vector<LoadedItem> &batch : batches)
+                for (const LoadedItem &item : batch)
+                    visit(item.key, item.value, item.expiresAt);
+    }
+
+    std::atomic<std::size_t> nextShard(0);
+    runPool([&](std::size_t) {
+        std::size_t i;
+        while ((i = nextShard++) < STORE_NUM_SHARDS) {
+            for (auto &batches : staged)
+                loadBatch_(i, batches[i]);
+        }
+    });
+}
+
+// Merges a batch of decoded items into one shard, then empties the batch for reuse.
+void Store::loadBatch_(std::size_t shardIdx, std::vector<LoadedItem> &batch) {
+    if (batch.empty()) return;
+
+    Shard &shard = shards_[shardIdx];
+    int64_t now = nowMs();
+    long added = 0;
+    {
+        ShardLock lock(shard.mtx);
+        for (LoadedItem &item : batch)
+            added += loadIntoShard_(shard, item, now);
+    }
+    size_ += added;
+    batch.clear();
+}
+
+// Inserts a decoded item, taking ownership of its key instead of copying it again.
+void Store::loadItem_(std::string &&key, StoreValue &&value, int64_t expiresAt) {
+    LoadedItem item;
+    item.hash = hashKey_(key);
+    item.key = std::move(key);
+    item.value = std::move(value);
+    item.expiresAt = expiresAt;
+
+    Shard &shard = shardFor_(item.hash);
+    ShardLock lock(shard.mtx);
+    size_ += loadIntoShard_(shard, item, nowMs());
+}
+
+// Returns the change in the number of keys, which is left for the caller to apply. An item that
+// expired while saved overwrites the key like any other, so the key is removed.
+long Store::loadIntoShard_(Shard &shard, LoadedItem &item, int64_t now) {
+    if (item.expiresAt != NO_EXPIRY && item.expiresAt <= now) {
+        clearExpiry_(shard, item.key, item.hash);
+        Slot *found = shard.map.findSlot(item.key, item.hash);
+        if (!found) return 0;
+        removeSlot_(shard, found);
+        return -1;
+    }
+
+    setExpiry_(shard, item.key, item.hash, item.expiresAt);
+    bool inserted;
+    Slot *slot = shard.map.findOrInsert(std::move(item.key), item.hash, inserted);
+    assign_(shard, *slot, std::move(item.value), inserted);
+    return inserted;
+}
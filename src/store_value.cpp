@@ -1,96 +1,221 @@
 #include "store_value.h"
 
+#include "byte_reader.h"
 #include "error_msgs.h"
 
+#include <algorithm>
 #include <fstream>
 
-std::vector<uint8_t> IntValue::serialize() const {
-    std::vector<uint8_t> buf;
-    buf.push_back('i');
+static_assert(sizeof(StoreValue) == 16, "StoreValue should stay a 16-byte tagged union");
 
-    // Push back multiple bytes with insert()
-    const uint8_t *val_ptr = reinterpret_cast<const uint8_t *>(&value_);
-    buf.insert(buf.end(), val_ptr, val_ptr + sizeof(value_));
-    return buf;
+// Strings that fit are copied inline, longer ones are moved onto the heap.
+StoreValue::StoreValue(ValueType type, std::string &s)
+    : type_(type) {
+    if (s.size() <= INLINE_CAPACITY) {
+        inlineLen_ = (uint8_t) s.size();
+        std::memcpy(data_, s.data(), s.size());
+    } else {
+        inlineLen_ = HEAP_STRING;
+        store_(new std::string(std::move(s)));
+    }
 }
 
-void IntValue::deserialize(std::ifstream &fp) {
-    fp.read(reinterpret_cast<char *>(&value_), sizeof(value_));
+// Copies a string straight from a buffer, without building a temporary std::string when it fits
+// inline.
+StoreValue::StoreValue(ValueType type, const char *s, std::size_t n)
+    : type_(type) {
+    if (n <= INLINE_CAPACITY) {
+        inlineLen_ = (uint8_t) n;
+        std::memcpy(data_, s, n);
+    } else {
+        inlineLen_ = HEAP_STRING;
+        store_(new std::string(s, n));
+    }
 }
 
-std::vector<uint8_t> FloatValue::serialize() const {
-    std::vector<uint8_t> buf;
-    buf.push_back('f');
+StoreValue StoreValue::makeList(ListItems &&l) {
+    StoreValue v;
+    v.type_ = ValueType::LIST;
+    v.store_(new ListValue(std::move(l)));
+    return v;
+}
 
-    const uint8_t *val_ptr = reinterpret_cast<const uint8_t *>(&value_);
-    buf.insert(buf.end(), val_ptr, val_ptr + sizeof(value_));
-    return buf;
+void StoreValue::copyHeap_(const StoreValue &other) {
+    if (other.type_ == ValueType::LIST)
+        store_(new ListValue(other.getList()));
+    else
+        store_(new std::string(*other.load_<std::string *>()));
 }
 
-void FloatValue::deserialize(std::ifstream &fp) {
-    fp.read(reinterpret_cast<char *>(&value_), sizeof(value_));
+void StoreValue::releaseHeap_() {
+    if (type_ == ValueType::LIST)
+        delete load_<ListValue *>();
+    else
+        delete load_<std::string *>();
 }
 
-// Strings are serialized as [ss][size][string]
-std::vector<uint8_t> StringValue::serialize() const {
-    std::vector<uint8_t> buf;
-    buf.push_back('s');
-    buf.push_back('s');
+int StoreValue::getInt() const { return load_<int>(); }
 
-    const size_t &strSize = value_.size();
-    const uint8_t *size_ptr = reinterpret_cast<const uint8_t *>(&strSize);
-    buf.insert(buf.end(), size_ptr, size_ptr + sizeof(strSize));
+float StoreValue::getFloat() const { return load_<float>(); }
 
-    buf.insert(buf.end(), value_.begin(), value_.end());
-    return buf;
+const char *StoreValue::stringData() const {
+    return inlineLen_ == HEAP_STRING ? load_<std::string *>()->data() : data_;
+}
+
+std::size_t StoreValue::stringSize() const {
+    return inlineLen_ == HEAP_STRING ? load_<std::string *>()->size() : inlineLen_;
 }
 
-void StringValue::deserialize(std::ifstream &fp) {
-    size_t strSize;
-    fp.read(reinterpret_cast<char *>(&strSize), sizeof(strSize));
+std::string StoreValue::getString() const { return std::string(stringData(), stringSize()); }
 
-    value_ = std::string(strSize, '\0');
-    fp.read(&value_[0], strSize);
+ListValue &StoreValue::getList() { return *load_<ListValue *>(); }
+
+const ListValue &StoreValue::getList() const { return *load_<ListValue *>(); }
+
+void StoreValue::incr() {
+    if (type_ == ValueType::INT)
+        store_(getInt() + 1);
+    else if (type_ == ValueType::FLOAT)
+        store_(getFloat() + 1);
 }
 
-// Identifiers are serialized as [si][size][string]
-std::vector<uint8_t> IdentifierValue::serialize() const {
-    std::vector<uint8_t> buf = StringValue::serialize();
-    buf[1] = 'i';
-    return buf;
+void StoreValue::decr() {
+    if (type_ == ValueType::INT)
+        store_(getInt() - 1);
+    else if (type_ == ValueType::FLOAT)
+        store_(getFloat() - 1);
 }
 
-// Lists are serialized as [l][num elements][e1|e2|...|en|]
-std::vector<uint8_t> ListValue::serialize() const {
-    std::vector<uint8_t> buf;
-    buf.push_back('l');
+// Inline payloads are counted as part of the value itself, heap payloads are added on top.
+std::size_t StoreValue::size() const {
+    std::size_t total = sizeof(StoreValue);
+    if (isString() && inlineLen_ == HEAP_STRING)
+        total += sizeof(std::string) + load_<std::string *>()->capacity();
+    else if (type_ == ValueType::LIST)
+        total += getList().size();
+    return total;
+}
+
+std::string StoreValue::string() const {
+    switch (type_) {
+        case ValueType::INT: return "int: " + std::to_string(getInt());
+        case ValueType::FLOAT: return "float: " + std::to_string(getFloat());
+        case ValueType::STRING: return "str: " + getString();
+        case ValueType::IDENTIFIER: return "id: " + getString();
+        case ValueType::LIST: return getList().string();
+        case ValueType::NIL:
+        default: return "<nil>";
+    }
+}
+
+/* Encodings by type:
+ *  int, float:     [i|f][raw value]
+ *  string:         [ss][size][string]
+ *  identifier:     [si][size][string]
+ *  list:           [l][num elements][e1|e2|...|en|]
+ *  nil:            [n]
+ */
+void StoreValue::serializeInto(std::vector<uint8_t> &buf) const {
+    switch (type_) {
+        case ValueType::INT:
+        case ValueType::FLOAT:
+            buf.push_back(type_ == ValueType::INT ? 'i' : 'f');
+            buf.insert(buf.end(), data_, data_ + sizeof(int));
+            break;
+        case ValueType::STRING:
+        case ValueType::IDENTIFIER: {
+            buf.push_back('s');
+            buf.push_back(type_ == ValueType::STRING ? 's' : 'i');
 
-    const size_t &numElem = value_.size();
-    const uint8_t *size_ptr = reinterpret_cast<const uint8_t *>(&numElem);
-    buf.insert(buf.end(), size_ptr, size_ptr + sizeof(numElem));
+            const size_t strSize = stringSize();
+            const uint8_t *size_ptr = reinterpret_cast<const uint8_t *>(&strSize);
+            buf.insert(buf.end(), size_ptr, size_ptr + sizeof(strSize));
 
-    for (const auto &item : value_) {
-        std::vector<uint8_t> bytes = item->serialize();
-        buf.insert(buf.end(), bytes.begin(), bytes.end());
+            const char *str = stringData();
+            buf.insert(buf.end(), str, str + strSize);
+            break;
+        }
+        case ValueType::LIST: {
+            buf.push_back('l');
+
+            const ListItems &items = getList().getValue();
+            const size_t numElem = items.size();
+            const uint8_t *size_ptr = reinterpret_cast<const uint8_t *>(&numElem);
+            buf.insert(buf.end(), size_ptr, size_ptr + sizeof(numElem));
+
+            for (const StoreValue &item : items)
+                item.serializeInto(buf);
+            break;
+        }
+        case ValueType::NIL:
+        default: buf.push_back('n'); break;
     }
+}
+
+std::vector<uint8_t> StoreValue::serialize() const {
+    std::vector<uint8_t> buf;
+    serializeInto(buf);
     return buf;
 }
 
-void ListValue::deserialize(std::ifstream &fp) {
-    size_t numVals;
-    fp.read(reinterpret_cast<char *>(&numVals), sizeof(size_t));
+ListValue::ListValue(ListItems &&l)
+    : value_(std::move(l))
+    , itemsSize_(0) {
+    for (const StoreValue &item : value_)
+        itemsSize_ += item.size();
+}
+
+void ListValue::append(StoreValue item) {
+    itemsSize_ += item.size();
+    value_.push_back(std::move(item));
+}
+
+void ListValue::prepend(StoreValue item) {
+    itemsSize_ += item.size();
+    value_.push_front(std::move(item));
+}
+
+StoreValue ListValue::popFront() {
+    StoreValue item = std::move(value_.front());
+    value_.pop_front();
+    itemsSize_ -= item.size();
+    return item;
+}
 
-    std::vector<StoreValueSP> lst = std::vector<StoreValueSP>();
-    for (size_t i = 0; i < numVals; i++)
-        lst.push_back(fromFile(fp));
-    value_ = lst;
+StoreValue ListValue::popBack() {
+    StoreValue item = std::move(value_.back());
+    value_.pop_back();
+    itemsSize_ -= item.size();
+    return item;
 }
 
-std::size_t ListValue::size() const {
-    std::size_t totalSize = sizeof(value_);
-    for (const auto &item : value_)
-        totalSize += item->size();
-    return totalSize;
+void ListValue::replace(std::size_t i, StoreValue item) {
+    itemsSize_ += item.size();
+    itemsSize_ -= value_[i].size();
+    value_[i] = std::move(item);
+}
+
+void ListValue::trim(std::size_t from, std::size_t to) {
+    for (std::size_t i = 0; i < from; i++)
+        itemsSize_ -= value_[i].size();
+    for (std::size_t i = to; i < value_.size(); i++)
+        itemsSize_ -= value_[i].size();
+
+    value_.erase(value_.begin() + to, value_.end());
+    value_.erase(value_.begin(), value_.begin() + from);
+}
+
+bool ListValue::toRange(long start, long stop, std::size_t &from, std::size_t &to) const {
+    long len = static_cast<long>(value_.size());
+    if (start < 0) start += len;
+    if (stop < 0) stop += len;
+    if (start < 0) start = 0;
+    if (stop >= len) stop = len - 1;
+    if (start > stop) return false;
+
+    from = start;
+    to = stop + 1;
+    return true;
 }
 
 // Getting the string() of list elements
@@ -98,11 +223,7 @@ std::string ListValue::string() const {
     std::string res = "list: [";
 
     for (size_t i = 0; i < value_.size(); i++) {
-        if (value_[i])
-            res += value_[i]->string();
-        else
-            res += "<nil>";
-
+        res += value_[i].string();
         if (i < value_.size() - 1) res += ", ";
     }
     res += "]";
@@ -115,32 +236,50 @@ void StoreValue::toFile(std::ofstream &fp) const {
     fp.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
 }
 
-// Reads a StoreValue from the file, assuming the file is a valid KEPLER-SAVE.
-StoreValueSP StoreValue::fromFile(std::ifstream &fp) {
-    char type;
-    fp.read(&type, sizeof(char));
-
-    StoreValueSP value = nullptr;
-    switch (type) {
-        case 'i': value = std::make_shared<IntValue>(); break;
-        case 'f': value = std::make_shared<FloatValue>(); break;
+// Decodes a StoreValue from a buffer holding valid KEPLER-SAVE data. String payloads are copied
+// out in one piece; truncated data throws instead of reading past the buffer.
+StoreValue StoreValue::fromBytes(ByteReader &reader) {
+    switch (reader.readChar()) {
+        case 'i': return StoreValue(reader.read<int>());
+        case 'f': return StoreValue(reader.read<float>());
         case 's': {
-            char strType;
-            fp.read(&strType, sizeof(char));
-
-            if (strType == 's')
-                value = std::make_shared<StringValue>();
-            else if (strType == 'i')
-                value = std::make_shared<IdentifierValue>();
-            else
-                throw RuntimeErr(UNK_SAVE_ITEM);
-            break;
+            char strType = reader.readChar();
+            if (strType != 's' && strType != 'i') throw RuntimeErr(UNK_SAVE_ITEM);
+
+            size_t strSize = reader.read<size_t>();
+            const char *str = reader.take(strSize);
+            return strType == 's' ? makeString(str, strSize) : makeIdentifier(str, strSize);
+        }
+        case 'l': {
+            size_t numVals = reader.read<size_t>();
+
+            // Truncated data throws before a corrupt count could run away
+            ListItems lst;
+            for (size_t i = 0; i < numVals; i++)
+                lst.push_back(fromBytes(reader));
+            return makeList(std::move(lst));
         }
-        case 'l': value = std::make_shared<ListValue>(); break;
+        case 'n': return StoreValue();
         default: throw RuntimeErr(UNK_SAVE_ITEM); break;
     }
+}
 
-    if (!value) return nullptr;
-    value->deserialize(fp);
-    return value;
+// Moves the reader past one encoded StoreValue without materializing it.
+void StoreValue::skipBytes(ByteReader &reader) {
+    switch (reader.readChar()) {
+        case 'i': reader.skip(sizeof(int)); break;
+        case 'f': reader.skip(sizeof(float)); break;
+        case 's':
+            reader.skip(1);
+            reader.skip(reader.read<size_t>());
+            break;
+        case 'l': {
+            size_t numVals = reader.read<size_t>();
+            for (size_t i = 0; i < numVals; i++)
+                skipBytes(reader);
+            break;
+        }
+        case 'n': break;
+        default: throw RuntimeErr(UNK_SAVE_ITEM); break;
+    }
 }
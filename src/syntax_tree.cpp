@@ -18,28 +18,49 @@ std::string IntNode::string() const {
     return "{node: Value, type: Int, value: " + std::to_string(value_) + "}";
 }
 
-StoreValueSP IntNode::evaluate() const { return std::make_shared<IntValue>(value_); }
+StoreValue IntNode::evaluate() const { return StoreValue(value_); }
 
 std::string FloatNode::string() const {
     return "{node: Value, type: Float, value: " + std::to_string(value_) + "}";
 }
 
-StoreValueSP FloatNode::evaluate() const { return std::make_shared<FloatValue>(value_); }
+StoreValue FloatNode::evaluate() const { return StoreValue(value_); }
 
 std::string StringNode::string() const {
     return "{node: Value, type: String, value: " + value_ + "}";
 }
 
-StoreValueSP StringNode::evaluate() const {
-    return std::make_shared<StringValue>(std::move(value_));
+StoreValue StringNode::evaluate() const {
+    return StoreValue::makeString(value_.data(), value_.size());
 }
 
+StoreValue StringNode::take() { return StoreValue::makeString(std::move(value_)); }
+
 std::string IdentifierNode::string() const {
     return "{node: Value, type: Identifier, value: " + value_ + "}";
 }
 
-StoreValueSP IdentifierNode::evaluate() const {
-    return std::make_shared<IdentifierValue>(std::move(value_));
+StoreValue IdentifierNode::evaluate() const {
+    return StoreValue::makeIdentifier(value_.data(), value_.size());
+}
+
+StoreValue IdentifierNode::take() { return StoreValue::makeIdentifier(std::move(value_)); }
+
+NodeType LiteralNode::getNodeType() const {
+    switch (value_.getValueType()) {
+        case ValueType::INT: return NodeType::INT;
+        case ValueType::FLOAT: return NodeType::FLOAT;
+        case ValueType::STRING: return NodeType::STRING;
+        case ValueType::LIST: return NodeType::LIST;
+        // Never an identifier, which borrowing its key relies on
+        case ValueType::IDENTIFIER:
+        case ValueType::NIL:
+        default: return NodeType::NIL;
+    }
+}
+
+std::string LiteralNode::string() const {
+    return "{node: Value, type: Literal, value: " + value_.string() + "}";
 }
 
 std::string ListNode::string() const {
@@ -56,9 +77,16 @@ std::string ListNode::string() const {
     return s;
 }
 
-StoreValueSP ListNode::evaluate() const {
-    std::shared_ptr<ListValue> listVal = std::make_shared<ListValue>();
+StoreValue ListNode::evaluate() const {
+    ListItems items;
+    for (const auto &node : value_)
+        items.push_back(node->evaluate());
+    return StoreValue::makeList(std::move(items));
+}
+
+StoreValue ListNode::take() {
+    ListItems items;
     for (const auto &node : value_)
-        listVal->append(node->evaluate());
-    return listVal;
+        items.push_back(node->take());
+    return StoreValue::makeList(std::move(items));
 }
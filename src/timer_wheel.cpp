@@ -0,0 +1,99 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+
+static constexpr uint64_t SLOT_MASK = TIMER_WHEEL_SLOTS - 1;
+
+// Time spanned by one slot of a wheel, and by a whole wheel one level below
+static inline int64_t span(unsigned int level) {
+    return (int64_t) 1 << (level * TIMER_WHEEL_SLOT_BITS);
+}
+
+// An entry, plus its key's heap if the key is too long for the string's own buffer
+static inline std::size_t entryBytes(const std::string &key) {
+    static const std::size_t inlineKey = std::string().capacity();
+    return sizeof(TimerWheel::Entry) + (key.size() > inlineKey ? key.size() + 1 : 0);
+}
+
+TimerWheel::TimerWheel(int64_t now)
+    : occupied_()
+    , now_(now)
+    , size_(0)
+    , bytes_(0) { }
+
+void TimerWheel::schedule(std::string key, std::size_t hash, int64_t deadline) {
+    bytes_ += entryBytes(key);
+    insert_(Entry { deadline, hash, std::move(key) }, now_ + 1);
+}
+
+void TimerWheel::advance(int64_t now, std::vector<Entry> &due) {
+    while (now_ < now) {
+        if (!size_) {
+            now_ = now;
+            break;
+        }
+
+        // Nothing can fall due before the next multiple of the first wheel, which may cascade
+        if (!occupied_[0]) {
+            int64_t next = (now_ | (int64_t) SLOT_MASK) + 1;
+            if (next > now) {
+                now_ = now;
+                break;
+            }
+            now_ = next - 1;
+        }
+
+        now_++;
+        cascade_();
+
+        std::size_t s = now_ & SLOT_MASK;
+        if (!(occupied_[0] >> s & 1)) continue;
+
+        std::vector<Entry> &slot = slots_[0][s];
+        size_ -= slot.size();
+        for (Entry &entry : slot) {
+            bytes_ -= entryBytes(entry.key);
+            due.push_back(std::move(entry));
+        }
+        slot.clear();
+        occupied_[0] &= ~((uint64_t) 1 << s);
+    }
+}
+
+// Places an entry to fall due at its deadline, or at `earliest` if that is later.
+void TimerWheel::insert_(Entry &&entry, int64_t earliest) {
+    int64_t at = std::max(entry.deadline, earliest);
+    int64_t delta = at - now_;
+
+    unsigned int level = 0;
+    while (level + 1 < TIMER_WHEEL_LEVELS && delta >= span(level + 1))
+        level++;
+    if (delta >= span(TIMER_WHEEL_LEVELS)) at = now_ + span(TIMER_WHEEL_LEVELS) - 1;
+
+    std::size_t s = (at >> (level * TIMER_WHEEL_SLOT_BITS)) & SLOT_MASK;
+    slots_[level][s].push_back(std::move(entry));
+    occupied_[level] |= (uint64_t) 1 << s;
+    size_++;
+}
+
+// When the clock reaches a multiple of a wheel's span, the slot of the wheel above it that the
+// clock just entered is emptied into the wheels below. Higher wheels go first, since what they
+// cascade can land in a lower wheel's slot that is due to cascade at the same time.
+void TimerWheel::cascade_() {
+    unsigned int top = 0;
+    while (top + 1 < TIMER_WHEEL_LEVELS && !(now_ & (span(top + 1) - 1)))
+        top++;
+
+    for (unsigned int level = top; level >= 1; level--) {
+        std::size_t s = (now_ >> (level * TIMER_WHEEL_SLOT_BITS)) & SLOT_MASK;
+        if (!(occupied_[level] >> s & 1)) continue;
+
+        std::vector<Entry> entries;
+        entries.swap(slots_[level][s]);
+        occupied_[level] &= ~((uint64_t) 1 << s);
+        size_ -= entries.size();
+        // The first wheel's current slot is yet to fall due, so entries due now can still go there
+        for (Entry &entry : entries)
+            insert_(std::move(entry), now_);
+    }
+}
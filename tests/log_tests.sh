@@ -0,0 +1,64 @@
+#!/bin/bash
+
+T_RESET=$'\e[0m'
+T_BRED=$'\e[1;31m'
+T_BBLUE=$'\e[1;34m'
+T_BGREEN=$'\e[1;32m'
+T_BYLLW=$'\e[1;33m'
+
+echo "${T_BBLUE}Run each test with a command log, restart, and compare the state replayed.${T_RESET}"
+
+# Build executable at ../build
+cd ..
+mkdir -p build
+cd build
+cmake ..
+make clean
+make
+
+if [ $? -eq 0 ]; then
+    cd ../tests
+    echo "${T_BGREEN}SUCCESSFULLY BUILT${T_RESET}"
+else
+    echo "${T_BRED}ERROR BUILDING${T_RESET}"
+    exit 1
+fi
+
+KEPLER="../build/KeplerKV"
+
+# Each test is a pair: N_name.kep is run first with a fresh log, then N_name_check.kep is run
+# after restarting with the same log, and its output compared
+INPUT_DIR="./log_inputs/"
+OUTPUT_DIR="./log_outputs/"
+CLEAN_OUT="../scripts/sanitize_text.sh"
+
+# Make a directory for storing the results
+mkdir -p results
+RESULTS_DIR="./results/"
+
+printf "%-25s %s\n----------------------------------------\n" "TEST CASE" "RESULT"
+for input_file in ${INPUT_DIR}*.kep
+do
+    no_path=$(basename "$input_file")
+    name_base="${no_path%.*}"
+    [[ "$name_base" == *_check ]] && continue
+
+    log_file="${RESULTS_DIR}${name_base}.log"
+    res_file="${RESULTS_DIR}${name_base}_log_result.txt"
+    diff_file="${RESULTS_DIR}${name_base}_log_diff.txt"
+
+    rm -f "$log_file"
+    $KEPLER --log "$log_file" "$input_file" &> /dev/null
+
+    # Files saved by the first run are removed, so the replay can't read them back
+    rm -f ./*.kep
+    $KEPLER --log "$log_file" "${INPUT_DIR}${name_base}_check.kep" 2>&1| ${CLEAN_OUT} &> "$res_file"
+
+    diff -wB "${OUTPUT_DIR}${name_base}_out.txt" "$res_file" > "$diff_file"
+    if [ $? -eq 0 ]; then
+        printf "%-25s %s\n" "$no_path" "${T_BGREEN}PASSED${T_RESET}"
+    else
+        printf "%-25s %s\n" "$no_path" "${T_BRED}FAILED: wrong output${T_RESET}"
+    fi
+
+done
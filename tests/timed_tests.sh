@@ -0,0 +1,63 @@
+#!/bin/bash
+
+T_RESET=$'\e[0m'
+T_BRED=$'\e[1;31m'
+T_BBLUE=$'\e[1;34m'
+T_BGREEN=$'\e[1;32m'
+T_BYLLW=$'\e[1;33m'
+
+echo "${T_BBLUE}Run tests that wait for time to pass, and compare outputs.${T_RESET}"
+
+# Build executable at ../build
+cd ..
+mkdir -p build
+cd build
+cmake ..
+make clean
+make
+
+if [ $? -eq 0 ]; then
+    cd ../tests
+    echo "${T_BGREEN}SUCCESSFULLY BUILT${T_RESET}"
+else
+    echo "${T_BRED}ERROR BUILDING${T_RESET}"
+    exit 1
+fi
+
+KEPLER="../build/KeplerKV"
+
+# Each input is sent line by line to KeplerKV running interactively, except that a line reading
+# "sleep N" pauses for N seconds instead, so that deadlines can pass partway through
+INPUT_DIR="./timed_inputs/"
+OUTPUT_DIR="./timed_outputs/"
+CLEAN_OUT="../scripts/sanitize_text.sh"
+
+# Make a directory for storing the results
+mkdir -p results
+RESULTS_DIR="./results/"
+
+printf "%-25s %s\n----------------------------------------\n" "TEST CASE" "RESULT"
+for input_file in ${INPUT_DIR}*.kep
+do
+    no_path=$(basename "$input_file")
+    name_base="${no_path%.*}"
+
+    res_file="${RESULTS_DIR}${name_base}_timed_result.txt"
+    diff_file="${RESULTS_DIR}${name_base}_timed_diff.txt"
+
+    while IFS= read -r line; do
+        if [[ "$line" == sleep\ * ]]; then
+            sleep "${line#sleep }"
+        else
+            echo "$line"
+        fi
+    done < "$input_file" | $KEPLER 2>&1| ${CLEAN_OUT} &> "$res_file"
+
+    diff -wB "${OUTPUT_DIR}${name_base}_out.txt" "$res_file" > "$diff_file"
+    if [ $? -eq 0 ]; then
+        printf "%-25s %s\n" "$no_path" "${T_BGREEN}PASSED${T_RESET}"
+    else
+        printf "%-25s %s\n" "$no_path" "${T_BRED}FAILED: wrong output${T_RESET}"
+    fi
+
+done